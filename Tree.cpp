@@ -0,0 +1,296 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+
+#include "Tree.h"
+
+const int NODE_SLAB_SIZE = 4096;
+
+struct nodeSlab_t {
+    nodeSlab_t *previous;
+    node_t nodes[NODE_SLAB_SIZE];
+};
+
+thread_local nodePool_t nodePool = {};
+
+node_t *allocNode() {
+    if (node_t *node = nodePool.freeList) {
+        nodePool.freeList = node->parent;
+        return node;
+    }
+
+    if (!nodePool.slab || nodePool.used == NODE_SLAB_SIZE) {
+        auto slab = (nodeSlab_t *) malloc(sizeof(nodeSlab_t));
+        if (!slab)
+            return nullptr;
+
+        slab->previous = nodePool.slab;
+        nodePool.slab = slab;
+        nodePool.used = 0;
+    }
+
+    return nodePool.slab->nodes + nodePool.used++;
+}
+
+node_t *makeNode(node_t *parent, node_t *left, node_t *right, void *value) {
+    node_t *node = allocNode();
+    if (!node)
+        return nullptr;
+
+    node->parent = parent;
+    node->left = left;
+    node->right = right;
+    node->value = value;
+
+    if (left)
+        left->parent = node;
+    if (right)
+        right->parent = node;
+
+    return node;
+}
+
+void freeNode(node_t *node) {
+    if (!node)
+        return;
+
+    node->parent = nodePool.freeList;
+    nodePool.freeList = node;
+}
+
+tree_t *makeTree(node_t *head) {
+    auto tree = (tree_t *) calloc(1, sizeof(tree_t));
+    if (!tree)
+        return nullptr;
+
+    tree->head = head;
+
+    return tree;
+}
+
+void releaseNodePool() {
+    nodeSlab_t *slab = nodePool.slab;
+    while (slab) {
+        nodeSlab_t *previous = slab->previous;
+        free(slab);
+        slab = previous;
+    }
+
+    nodePool = {};
+}
+
+nodePool_t takeNodePool() {
+    nodePool_t pool = nodePool;
+    nodePool = {};
+
+    return pool;
+}
+
+void mergeNodePool(nodePool_t *from) {
+    assert(from);
+
+    if (from->freeList) {
+        node_t *last = from->freeList;
+        while (last->parent)
+            last = last->parent;
+
+        last->parent = nodePool.freeList;
+        nodePool.freeList = from->freeList;
+    }
+
+    if (from->slab) {
+        nodeSlab_t *oldest = from->slab;
+        while (oldest->previous)
+            oldest = oldest->previous;
+
+        // Slabs of from go behind the current one, so its free space is kept
+        if (nodePool.slab) {
+            oldest->previous = nodePool.slab->previous;
+            nodePool.slab->previous = from->slab;
+        } else {
+            nodePool.slab = from->slab;
+            nodePool.used = from->used;
+        }
+    }
+
+    *from = {};
+}
+
+// Explicit stack of the walks, grown with realloc; a failed push makes the walk return false
+
+template <typename T>
+struct walkStack_t {
+    T *items;
+    int count;
+    int capacity;
+};
+
+template <typename T>
+bool pushItem(walkStack_t<T> *stack, const T &item) {
+    assert(stack);
+
+    if (stack->count == stack->capacity) {
+        int capacity = stack->capacity ? stack->capacity * 2 : 256;
+        auto items = (T *) realloc(stack->items, sizeof(T) * capacity);
+        if (!items)
+            return false;
+
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+
+    stack->items[stack->count++] = item;
+
+    return true;
+}
+
+bool treeTraverse(node_t *node, bool (*visit)(node_t *, void *), void *context) {
+    assert(visit);
+
+    walkStack_t<node_t *> stack = {};
+    bool completed = true;
+
+    while (node) {
+        // Children are read before the visit, so visit may free the node
+        node_t *left = node->left;
+        node_t *right = node->right;
+
+        if (!visit(node, context)) {
+            completed = false;
+            break;
+        }
+
+        if (right && !pushItem(&stack, right)) {
+            completed = false;
+            break;
+        }
+
+        if (left) {
+            node = left;
+        } else {
+            node = stack.count ? stack.items[--stack.count] : nullptr;
+        }
+    }
+
+    free(stack.items);
+    return completed;
+}
+
+bool recycleNode(node_t *node, void *) {
+    freeNode(node);
+    return true;
+}
+
+void freeTree(tree_t *tree) {
+    if (!tree)
+        return;
+
+    treeTraverse(tree->head, recycleNode, nullptr);
+    free(tree);
+}
+
+const size_t DUMP_LABEL_SIZE = 1024;
+
+struct dumpItem_t {
+    node_t *node;
+    node_t *parent; // Drawn parent, nullptr for the head
+    bool left; // Side of the parent the node hangs on
+    int depth;
+};
+
+void dumpEdge(FILE *f, const dumpItem_t *item, const char *target) {
+    if (!item->parent)
+        return;
+
+    const char *side = item->left ? "left" : "right";
+    fprintf(f, "%s -> node%p:%s;\n", target, item->parent, side);
+    fprintf(f, "node%p:%s -> %s;\n", item->parent, side, target);
+}
+
+bool treeDump(tree_t *tree, const char *filename, const char *(*dumpValue)(void *, char *, size_t),
+              const treeDumpOptions_t *options) {
+    assert(tree);
+    assert(filename);
+    assert(dumpValue);
+
+    FILE *f = fopen(filename, "w");
+    if (!f)
+        return false;
+
+    treeDumpOptions_t none = {};
+    if (!options)
+        options = &none;
+
+    fprintf(f, "digraph {\nconcentrate=true\n");
+
+    char label[DUMP_LABEL_SIZE];
+    char target[64];
+    walkStack_t<dumpItem_t> stack = {};
+    bool completed = !tree->head || pushItem(&stack, {tree->head, nullptr, false, 0});
+
+    while (completed && stack.count) {
+        dumpItem_t item = stack.items[--stack.count];
+        node_t *node = item.node;
+
+        if (options->maxDepth && item.depth > options->maxDepth) {
+            snprintf(target, sizeof(target), "more%p", (void *) node);
+            fprintf(f, "%s[shape=plaintext, label=\"...\"];\n", target);
+            dumpEdge(f, &item, target);
+            continue;
+        }
+
+        // Collapsed spine: items of the following links hang on the first one, which stands for the whole chain
+        int links = 1;
+        int items = 0;
+        node_t *next = node->left;
+        bool spine = options->isSpine && options->isSpine(node->value);
+        int pushed = stack.count;
+
+        if (spine) {
+            for (node_t *link = node; completed && link; link = next, links++) {
+                if (link->right && (!options->maxSpineItems || items < options->maxSpineItems)) {
+                    completed = pushItem(&stack, {link->right, node, false, item.depth + 1});
+                    items++;
+                }
+
+                next = link->left;
+                if (!next || !options->isSpine(next->value))
+                    break;
+            }
+
+            // Items are pushed in chain order, the first one has to be drawn first
+            std::reverse(stack.items + pushed, stack.items + stack.count);
+        } else if (node->right) {
+            completed = pushItem(&stack, {node->right, node, false, item.depth + 1});
+        }
+
+        if (next && completed)
+            completed = pushItem(&stack, {next, node, true, item.depth + 1});
+
+        const char *color = "springgreen";
+        if (node == tree->head)
+            color = "mediumturquoise";
+        else if (item.left)
+            color = "indianred";
+
+        const char *text = dumpValue(node->value, label, sizeof(label));
+        if (links > 1) {
+            fprintf(f, "node%p[shape=record, label=\"{%p | {PARENT|%p}| %s | %d LINKS, %d SHOWN | "
+                       "{{LEFT |<left> %p} | {RIGHT |<right> ...}}}\", style=filled, fillcolor=%s];\n",
+                    node, node, item.parent, text, links, items, next, color);
+        } else {
+            fprintf(f, "node%p[shape=record, label=\"{%p | {PARENT|%p}| %s | {{LEFT |<left> %p} | {RIGHT |<right> %p}}}\", "
+                       "style=filled, fillcolor=%s];\n",
+                    node, node, item.parent, text, node->left, node->right, color);
+        }
+
+        snprintf(target, sizeof(target), "node%p", (void *) node);
+        dumpEdge(f, &item, target);
+    }
+
+    free(stack.items);
+    fprintf(f, "}\n");
+
+    return fclose(f) == 0 && completed;
+}
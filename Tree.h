@@ -0,0 +1,55 @@
+#ifndef _TREE_
+#define _TREE_
+
+#include <cstddef>
+
+// Binary tree with opaque values.
+// Nodes come from a per-thread slab pool: allocation is a free list pop or a pointer bump, and a freed node is
+// recycled by the thread that frees it. All walks use an explicit stack, so tree depth is limited by memory only
+
+struct node_t {
+    node_t *parent;
+    node_t *left;
+    node_t *right;
+    void *value;
+};
+
+struct tree_t {
+    node_t *head;
+};
+
+struct nodeSlab_t;
+
+struct nodePool_t {
+    nodeSlab_t *slab; // Newest slab, linked to the older ones
+    int used; // Nodes handed out from the current slab
+    node_t *freeList; // Linked through parent
+};
+
+node_t *makeNode(node_t *parent, node_t *left, node_t *right, void *value); // Also sets parent of the children
+
+void freeNode(node_t *node);
+
+tree_t *makeTree(node_t *head);
+
+void freeTree(tree_t *tree); // Returns all nodes to the pool, values are not touched
+
+void releaseNodePool(); // Frees every slab of the calling thread, all its nodes become invalid
+
+nodePool_t takeNodePool(); // Leaves the calling thread with an empty pool, the nodes stay valid
+
+void mergeNodePool(nodePool_t *from); // Hands slabs and free nodes of from over to the calling thread
+
+bool treeTraverse(node_t *node, bool (*visit)(node_t *node, void *context), void *context); // Preorder, stops on false
+
+struct treeDumpOptions_t {
+    int maxDepth; // Deeper subtrees are drawn as "...", 0 for no limit
+    bool (*isSpine)(void *value); // Chains of such nodes through left are drawn as one node, nullptr to draw every node
+    int maxSpineItems; // Items drawn for a collapsed chain, 0 for all
+};
+
+// Graphviz. dumpValue writes the label into the buffer it is given, or returns a constant string
+bool treeDump(tree_t *tree, const char *filename, const char *(*dumpValue)(void *value, char *buffer, size_t size),
+              const treeDumpOptions_t *options);
+
+#endif
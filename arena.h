@@ -0,0 +1,110 @@
+#ifndef _ARENA_
+#define _ARENA_
+
+#include <cstdlib>
+#include <cstring>
+
+// Bump allocator: memory is handed out from large blocks and released all at once.
+// Blocks are never moved, so pointers stay valid until freeArena
+
+const size_t ARENA_BLOCK_SIZE = 1 << 16;
+const size_t ARENA_ALIGNMENT = alignof(void *); // AST structures hold nothing wider than pointers
+
+struct arenaBlock_t {
+    arenaBlock_t *previous;
+    size_t size; // Usable bytes after the header
+    size_t used;
+};
+
+struct arena_t {
+    arenaBlock_t *current;
+    size_t allocated; // Bytes handed out, for statistics
+};
+
+const size_t ARENA_HEADER_SIZE = (sizeof(arenaBlock_t) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+
+inline char *arenaBlockData(arenaBlock_t *block) {
+    return (char *) block + ARENA_HEADER_SIZE;
+}
+
+arenaBlock_t *makeArenaBlock(size_t size, arenaBlock_t *previous) {
+    auto block = (arenaBlock_t *) malloc(ARENA_HEADER_SIZE + size);
+    if (!block)
+        return nullptr;
+
+    block->previous = previous;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+void *arenaAlloc(arena_t *arena, size_t size) { // Zeroed memory aligned for any type, nullptr if out of memory
+    assert(arena);
+
+    size = (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+
+    arenaBlock_t *block = arena->current;
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        // Large allocations get a block of their own behind the current one, so its free space is not wasted
+        block = makeArenaBlock(size, block ? block->previous : nullptr);
+        if (!block)
+            return nullptr;
+
+        if (arena->current)
+            arena->current->previous = block;
+        else
+            arena->current = block;
+    } else if (!block || block->size - block->used < size) {
+        block = makeArenaBlock(ARENA_BLOCK_SIZE, block);
+        if (!block)
+            return nullptr;
+
+        arena->current = block;
+    }
+
+    void *memory = arenaBlockData(block) + block->used;
+    block->used += size;
+    arena->allocated += size;
+
+    memset(memory, 0, size);
+    return memory;
+}
+
+void mergeArena(arena_t *arena, arena_t *from) { // Hands all blocks of from over to arena, pointers stay valid
+    assert(arena);
+    assert(from);
+
+    if (!from->current)
+        return;
+
+    arenaBlock_t *oldest = from->current;
+    while (oldest->previous)
+        oldest = oldest->previous;
+
+    // Blocks of from go behind the current one of arena, so its free space is kept
+    if (arena->current) {
+        oldest->previous = arena->current->previous;
+        arena->current->previous = from->current;
+    } else {
+        arena->current = from->current;
+    }
+
+    arena->allocated += from->allocated;
+    *from = {};
+}
+
+void freeArena(arena_t *arena) {
+    assert(arena);
+
+    arenaBlock_t *block = arena->current;
+    while (block) {
+        arenaBlock_t *previous = block->previous;
+        free(block);
+        block = previous;
+    }
+
+    *arena = {};
+}
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef _AST_
+#define _AST_
+
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+// Flat AST: nodes in preorder in one array, each with its type and id inlined.
+// Children of a node are a contiguous run of 32-bit indices in a separate array. Statement lists (B),
+// definitions (P) and parameter lists (VARLIST) keep all their items as direct children instead of left-linked spines,
+// other nodes keep the left and right slot of the binary tree, with AST_NIL for a missing child
+
+const uint32_t AST_NIL = UINT32_MAX;
+
+struct astNode_t {
+    uint32_t firstChild; // Index in children
+    uint32_t childCount;
+    int id;
+    NODE_TYPE type;
+};
+
+struct flatAst_t {
+    astNode_t *nodes;
+    int nodesCount;
+    int nodesCapacity;
+
+    uint32_t *children;
+    int childrenCount;
+    int childrenCapacity;
+};
+
+void freeFlatAst(flatAst_t *ast) {
+    assert(ast);
+
+    free(ast->nodes);
+    free(ast->children);
+
+    *ast = {};
+}
+
+bool reserveFlatAst(flatAst_t *ast, int nodes, int children) { // Capacity for an empty AST
+    assert(ast);
+    assert(!ast->nodesCount && !ast->childrenCount);
+
+    ast->nodes = (astNode_t *) realloc(ast->nodes, sizeof(astNode_t) * nodes);
+    ast->children = (uint32_t *) realloc(ast->children, sizeof(uint32_t) * children);
+    ast->nodesCapacity = ast->nodes ? nodes : 0;
+    ast->childrenCapacity = ast->children ? children : 0;
+
+    return ast->nodes && ast->children;
+}
+
+bool isAstList(NODE_TYPE type) {
+    return type == B || type == P || type == VARLIST;
+}
+
+uint32_t addAstNode(flatAst_t *ast, NODE_TYPE type, int id) { // AST_NIL if out of memory
+    assert(ast);
+
+    if (ast->nodesCount == ast->nodesCapacity) {
+        int capacity = ast->nodesCapacity ? ast->nodesCapacity * 2 : 256;
+        auto nodes = (astNode_t *) realloc(ast->nodes, sizeof(astNode_t) * capacity);
+        if (!nodes)
+            return AST_NIL;
+
+        ast->nodes = nodes;
+        ast->nodesCapacity = capacity;
+    }
+
+    ast->nodes[ast->nodesCount] = {0, 0, id, type};
+
+    return ast->nodesCount++;
+}
+
+bool reserveAstChildren(flatAst_t *ast, uint32_t node, int count) { // Gives node a run of count unset children
+    assert(ast);
+
+    if (ast->childrenCount + count > ast->childrenCapacity) {
+        int capacity = ast->childrenCapacity ? ast->childrenCapacity * 2 : 256;
+        while (capacity < ast->childrenCount + count)
+            capacity *= 2;
+
+        auto children = (uint32_t *) realloc(ast->children, sizeof(uint32_t) * capacity);
+        if (!children)
+            return false;
+
+        ast->children = children;
+        ast->childrenCapacity = capacity;
+    }
+
+    ast->nodes[node].firstChild = ast->childrenCount;
+    ast->nodes[node].childCount = count;
+    ast->childrenCount += count;
+
+    return true;
+}
+
+inline uint32_t getAstChild(const flatAst_t *ast, uint32_t node, uint32_t child) {
+    return ast->children[ast->nodes[node].firstChild + child];
+}
+
+int countSpine(node_t *node) {
+    int count = 0;
+    for (; node; node = node->left)
+        count++;
+
+    return count;
+}
+
+struct flattenItem_t {
+    node_t *node;
+    int slot; // Position in children that receives the node index, -1 for the root
+};
+
+bool flattenTree(tree_t *tree, flatAst_t *ast) { // Explicit stack, so the depth of the tree costs no recursion
+    assert(tree);
+    assert(ast);
+
+    *ast = {};
+    if (!tree->head)
+        return true;
+
+    std::vector<flattenItem_t> stack;
+    stack.push_back({tree->head, -1});
+
+    while (!stack.empty()) {
+        flattenItem_t item = stack.back();
+        stack.pop_back();
+
+        node_t *node = item.node;
+        auto value = (value_t *) node->value;
+        uint32_t index = addAstNode(ast, value->type, value->id);
+        if (index == AST_NIL) {
+            freeFlatAst(ast);
+            return false;
+        }
+
+        if (item.slot != -1)
+            ast->children[item.slot] = index;
+
+        if (isAstList(value->type)) {
+            // P and B hang their spine on the right, VARLIST is the spine itself unless it is the empty placeholder
+            node_t *spine = value->type == VARLIST ? (node->right ? node : nullptr) : node->right;
+            int count = countSpine(spine);
+            if (!reserveAstChildren(ast, index, count)) {
+                freeFlatAst(ast);
+                return false;
+            }
+
+            // P spine goes from the last definition to the first one, the other spines are in source order.
+            // First item in source order has to be on top of the stack
+            int first = ast->nodes[index].firstChild;
+            for (int i = 0; spine; spine = spine->left, i++) {
+                int slot = value->type == P ? count - 1 - i : i;
+                stack.push_back({spine->right, first + slot});
+            }
+
+            if (value->type != P)
+                std::reverse(stack.end() - count, stack.end());
+        } else if (node->left || node->right) {
+            if (!reserveAstChildren(ast, index, 2)) {
+                freeFlatAst(ast);
+                return false;
+            }
+
+            int first = ast->nodes[index].firstChild;
+            ast->children[first] = AST_NIL;
+            ast->children[first + 1] = AST_NIL;
+
+            if (node->right)
+                stack.push_back({node->right, first + 1});
+            if (node->left)
+                stack.push_back({node->left, first});
+        }
+    }
+
+    return true;
+}
+
+bool reorderAstPreorder(flatAst_t *ast) { // Renumbers the nodes into preorder with children in list order
+    assert(ast);
+
+    if (!ast->nodesCount)
+        return true;
+
+    std::vector<uint32_t> order(ast->nodesCount, AST_NIL);
+    std::vector<uint32_t> stack;
+    stack.push_back(0);
+
+    uint32_t next = 0;
+    while (!stack.empty()) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+
+        order[node] = next++;
+        for (uint32_t i = ast->nodes[node].childCount; i > 0; i--) {
+            uint32_t child = getAstChild(ast, node, i - 1);
+            if (child != AST_NIL)
+                stack.push_back(child);
+        }
+    }
+
+    if (next != (uint32_t) ast->nodesCount) // Nodes not reachable from the root
+        return false;
+
+    auto nodes = (astNode_t *) malloc(sizeof(astNode_t) * ast->nodesCapacity);
+    if (!nodes)
+        return false;
+
+    for (int i = 0; i < ast->nodesCount; i++)
+        nodes[order[i]] = ast->nodes[i];
+    for (int i = 0; i < ast->childrenCount; i++)
+        if (ast->children[i] != AST_NIL)
+            ast->children[i] = order[ast->children[i]];
+
+    free(ast->nodes);
+    ast->nodes = nodes;
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,430 @@
+#ifndef _AST_FILE_
+#define _AST_FILE_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Binary AST file, the alternative to the text output.
+// Fixed-width native little-endian sections at 8-byte aligned offsets, so a mapping of the file can be used in place:
+//   header
+//   string offsets: uint32_t[stringsCount + 1], identifier i is data[offsets[i], offsets[i + 1])
+//   string data: identifier names without separators
+//   definitions: one entry per function, locates its subtree without decoding the others
+//   nodes: the flat AST in preorder, children follow their parent; lists keep their items, not the spine links
+// NODE_TYPE values and keyword ids of ARITHM_OP are part of the format, reordering them needs a new version
+
+const char AST_FILE_MAGIC[4] = {'C', 'A', 'S', 'T'};
+const uint32_t AST_FILE_VERSION = 1;
+
+enum AST_FILE_CHILDREN {
+    AST_FILE_LEFT = 1, // Binary node has its first child
+    AST_FILE_RIGHT = 2, // Binary node has its second child
+    AST_FILE_LIST = 4 // B, P or VARLIST, count items follow
+};
+
+struct astFileHeader_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t nodesCount;
+    uint32_t stringsCount;
+    uint32_t definitionsCount;
+    uint32_t reserved;
+    uint64_t stringOffsetsAt; // Byte offsets of the sections from the start of the file
+    uint64_t stringDataAt;
+    uint64_t definitionsAt;
+    uint64_t nodesAt;
+    uint64_t size; // Whole file
+};
+
+struct astFileNode_t {
+    uint16_t type; // NODE_TYPE
+    uint16_t children; // AST_FILE_CHILDREN bits
+    int32_t id; // String index for ID, value for NUM, operator for ARITHM_OP
+    uint32_t count; // Items of a list
+    uint32_t size; // Nodes in the subtree including this one, so a reader can skip it
+};
+
+struct astFileDefinition_t {
+    uint32_t name; // String index of the function name
+    uint32_t firstNode; // DEF node
+    uint32_t nodesCount;
+    uint32_t reserved;
+};
+
+inline uint64_t alignAstFileOffset(uint64_t offset) {
+    return (offset + 7) / 8 * 8;
+}
+
+bool writeAstFileSection(FILE *f, uint64_t at, const void *data, size_t size) { // Pads with zeros up to at
+    static const char zeros[8] = {};
+
+    long position = ftell(f);
+    if (position < 0 || (uint64_t) position > at || fwrite(zeros, 1, at - position, f) != at - position)
+        return false;
+
+    return fwrite(data, 1, size, f) == size;
+}
+
+bool saveBinaryAst(const flatAst_t *ast, const idTable_t *identifiers, const char *filename) {
+    assert(ast);
+    assert(identifiers);
+    assert(filename);
+
+    std::vector<uint32_t> stringOffsets(identifiers->count + 1);
+    for (int i = 0; i < identifiers->count; i++)
+        stringOffsets[i + 1] = stringOffsets[i] + identifiers->lengths[i];
+
+    // Subtree sizes come from a reverse pass: in preorder every child has a larger index than its parent
+    std::vector<astFileNode_t> nodes(ast->nodesCount);
+    for (int i = ast->nodesCount - 1; i >= 0; i--) {
+        const astNode_t *node = ast->nodes + i;
+        astFileNode_t *record = &nodes[i];
+
+        record->type = node->type;
+        record->id = node->id;
+        record->size = 1;
+
+        if (isAstList(node->type))
+            record->children = AST_FILE_LIST;
+
+        // Only a loaded AST can have empty list items, the format keeps the present ones
+        for (uint32_t child = 0; child < node->childCount; child++) {
+            uint32_t index = getAstChild(ast, i, child);
+            if (index == AST_NIL)
+                continue;
+
+            if (isAstList(node->type))
+                record->count++;
+            else
+                record->children |= child ? AST_FILE_RIGHT : AST_FILE_LEFT;
+            record->size += nodes[index].size;
+        }
+    }
+
+    // Program root lists the DEF nodes, the second child of DEF is the name.
+    // A loaded AST may hold anything there, items that are not named functions stay out of the table
+    std::vector<astFileDefinition_t> definitions;
+    if (ast->nodesCount && ast->nodes[0].type == P) {
+        for (uint32_t i = 0; i < ast->nodes[0].childCount; i++) {
+            uint32_t def = getAstChild(ast, 0, i);
+            if (def == AST_NIL || ast->nodes[def].type != DEF || ast->nodes[def].childCount != 2)
+                continue;
+
+            uint32_t name = getAstChild(ast, def, 1);
+            if (name == AST_NIL || ast->nodes[name].type != ID)
+                continue;
+
+            definitions.push_back({(uint32_t) ast->nodes[name].id, def, nodes[def].size, 0});
+        }
+    }
+
+    astFileHeader_t header = {};
+    memcpy(header.magic, AST_FILE_MAGIC, sizeof(header.magic));
+    header.version = AST_FILE_VERSION;
+    header.nodesCount = ast->nodesCount;
+    header.stringsCount = identifiers->count;
+    header.definitionsCount = definitions.size();
+
+    header.stringOffsetsAt = alignAstFileOffset(sizeof(header));
+    header.stringDataAt = header.stringOffsetsAt + sizeof(uint32_t) * stringOffsets.size();
+    header.definitionsAt = alignAstFileOffset(header.stringDataAt + stringOffsets.back());
+    header.nodesAt = alignAstFileOffset(header.definitionsAt + sizeof(astFileDefinition_t) * definitions.size());
+    header.size = header.nodesAt + sizeof(astFileNode_t) * nodes.size();
+
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+        return false;
+
+    bool written = writeAstFileSection(f, 0, &header, sizeof(header)) &&
+                   writeAstFileSection(f, header.stringOffsetsAt, stringOffsets.data(),
+                                       sizeof(uint32_t) * stringOffsets.size());
+
+    for (int i = 0; written && i < identifiers->count; i++)
+        written = fwrite(identifiers->names[i], 1, identifiers->lengths[i], f) == (size_t) identifiers->lengths[i];
+
+    written = written &&
+              writeAstFileSection(f, header.definitionsAt, definitions.data(),
+                                  sizeof(astFileDefinition_t) * definitions.size()) &&
+              writeAstFileSection(f, header.nodesAt, nodes.data(), sizeof(astFileNode_t) * nodes.size());
+
+    return fclose(f) == 0 && written;
+}
+
+struct astFileView_t {
+    void *mapping;
+    size_t size;
+
+    const astFileHeader_t *header;
+    const uint32_t *stringOffsets;
+    const char *strings;
+    const astFileDefinition_t *definitions;
+    const astFileNode_t *nodes;
+};
+
+void closeAstFile(astFileView_t *view) {
+    assert(view);
+
+    if (view->mapping)
+        munmap(view->mapping, view->size);
+
+    *view = {};
+}
+
+bool openAstFile(const char *filename, astFileView_t *view) { // Maps the file read-only and checks its layout
+    assert(filename);
+    assert(view);
+
+    *view = {};
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info = {};
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(astFileHeader_t)) {
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    view->mapping = mapping;
+    view->size = info.st_size;
+
+    auto data = (const char *) mapping;
+    auto header = (const astFileHeader_t *) data;
+
+    // Offsets are bounded by the file size first, so the sums below cannot wrap
+    bool valid = memcmp(header->magic, AST_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->version == AST_FILE_VERSION && header->size == view->size &&
+                 header->stringOffsetsAt <= header->size && header->stringDataAt <= header->size &&
+                 header->definitionsAt <= header->size && header->nodesAt <= header->size &&
+                 header->stringOffsetsAt + sizeof(uint32_t) * ((uint64_t) header->stringsCount + 1) <= header->stringDataAt &&
+                 header->stringDataAt <= header->definitionsAt &&
+                 header->definitionsAt + sizeof(astFileDefinition_t) * (uint64_t) header->definitionsCount <= header->nodesAt &&
+                 header->nodesAt + sizeof(astFileNode_t) * (uint64_t) header->nodesCount <= header->size &&
+                 header->stringOffsetsAt % 8 == 0 && header->definitionsAt % 8 == 0 && header->nodesAt % 8 == 0;
+
+    if (valid) {
+        view->stringOffsets = (const uint32_t *) (data + header->stringOffsetsAt);
+        valid = view->stringOffsets[0] == 0 &&
+                header->stringDataAt + view->stringOffsets[header->stringsCount] <= header->definitionsAt;
+
+        for (uint32_t i = 0; valid && i < header->stringsCount; i++)
+            valid = view->stringOffsets[i] <= view->stringOffsets[i + 1];
+    }
+
+    // Every definition has to name a string and cover a run of nodes inside the file
+    auto definitions = valid ? (const astFileDefinition_t *) (data + header->definitionsAt) : nullptr;
+    for (uint32_t i = 0; valid && i < header->definitionsCount; i++) {
+        valid = definitions[i].name < header->stringsCount && definitions[i].firstNode < header->nodesCount &&
+                definitions[i].nodesCount <= header->nodesCount - definitions[i].firstNode;
+    }
+
+    if (!valid) {
+        closeAstFile(view);
+        return false;
+    }
+
+    view->header = header;
+    view->strings = data + header->stringDataAt;
+    view->definitions = definitions;
+    view->nodes = (const astFileNode_t *) (data + header->nodesAt);
+
+    return true;
+}
+
+struct binaryFrame_t {
+    uint32_t node;
+    uint32_t end; // Index past the subtree
+    uint32_t next; // Children read so far
+    uint32_t count; // Children present in the file
+    bool skipLeft; // Binary node without its first child, the only child goes right
+};
+
+bool isAstFileOperator(int id) {
+    return id >= 0 && id < KEYWORDS_NUMBER && (bindingPowers.power[id] || id == sqrt);
+}
+
+const astFileDefinition_t *findAstDefinition(const astFileView_t *view, const char *name, size_t length) {
+    assert(view);
+    assert(view->header);
+    assert(name);
+
+    for (uint32_t i = 0; i < view->header->definitionsCount; i++) {
+        const astFileDefinition_t *definition = view->definitions + i;
+        uint32_t start = view->stringOffsets[definition->name];
+
+        if (view->stringOffsets[definition->name + 1] - start == length &&
+            memcmp(view->strings + start, name, length) == 0)
+            return definition;
+    }
+
+    return nullptr;
+}
+
+// Decodes the subtree of count nodes starting at first, its nodes are numbered from 0.
+// ids maps string indices to interned identifiers, -1 for the strings no node has used yet
+bool loadBinaryNodes(const astFileView_t *view, uint32_t first, uint32_t count, flatAst_t *ast, idTable_t *identifiers,
+                     std::vector<int> *ids) { // false if nodes are inconsistent
+    assert(view);
+    assert(view->header);
+    assert(ast);
+    assert(identifiers);
+    assert(ids);
+
+    const astFileHeader_t *header = view->header;
+    if (!count || count > INT32_MAX / 2 || first >= header->nodesCount || count > header->nodesCount - first)
+        return false;
+
+    // A child slot is taken by a list item or by one of the two slots of a binary node
+    *ast = {};
+    if (!reserveFlatAst(ast, count, count * 2))
+        return false;
+
+    ids->assign(header->stringsCount, -1);
+    std::vector<binaryFrame_t> frames;
+
+    // Nodes are in preorder like the flat AST, so every node keeps its index and hangs on the innermost open parent
+    bool valid = true;
+    for (uint32_t i = 0; valid && i < count; i++) {
+        while (valid && !frames.empty() && frames.back().next == frames.back().count) {
+            valid = frames.back().end == i;
+            frames.pop_back();
+        }
+
+        const astFileNode_t *record = view->nodes + first + i;
+        valid = valid && record->type <= RAMEXPLODE && record->size >= 1 && record->size <= count - i &&
+                (i == 0) == frames.empty();
+        if (!valid)
+            break;
+
+        if (!frames.empty()) {
+            binaryFrame_t *parent = &frames.back();
+            valid = i + record->size <= parent->end;
+
+            uint32_t slot = parent->next++ + parent->skipLeft;
+            ast->children[ast->nodes[parent->node].firstChild + slot] = i;
+        }
+
+        auto type = (NODE_TYPE) record->type;
+        int id = record->id;
+        if (type == ID && valid) {
+            valid = (uint32_t) id < header->stringsCount;
+            if (valid && (*ids)[id] == -1) {
+                const char *name = view->strings + view->stringOffsets[id];
+                int length = view->stringOffsets[id + 1] - view->stringOffsets[id];
+
+                unsigned hash = KEYWORD_SEED;
+                for (int c = 0; c < length; c++)
+                    hash = keywordHashStep(hash, name[c]);
+
+                (*ids)[id] = internIdentifier(identifiers, name, length, hash);
+            }
+            id = valid ? (*ids)[id] : -1;
+            valid = id != -1;
+        } else if (type == ARITHM_OP) {
+            valid = valid && isAstFileOperator(id);
+        }
+
+        if (!valid || addAstNode(ast, type, id) == AST_NIL) {
+            valid = false;
+            break;
+        }
+
+        binaryFrame_t frame = {i, i + record->size, 0, 0, false};
+        if (record->children == AST_FILE_LIST) {
+            frame.count = record->count;
+            valid = isAstList(type) && record->count < record->size && reserveAstChildren(ast, i, record->count);
+        } else if (record->children) {
+            frame.count = record->children == (AST_FILE_LEFT | AST_FILE_RIGHT) ? 2 : 1;
+            frame.skipLeft = !(record->children & AST_FILE_LEFT);
+            valid = !isAstList(type) && record->children <= (AST_FILE_LEFT | AST_FILE_RIGHT) &&
+                    frame.count < record->size && reserveAstChildren(ast, i, 2);
+
+            if (valid) {
+                ast->children[ast->nodes[i].firstChild] = AST_NIL;
+                ast->children[ast->nodes[i].firstChild + 1] = AST_NIL;
+            }
+        } else {
+            valid = record->size == 1;
+        }
+
+        if (frame.count)
+            frames.push_back(frame);
+    }
+
+    // Whatever is still open has to be complete and end with the subtree
+    for (const binaryFrame_t &frame : frames)
+        valid = valid && frame.next == frame.count && frame.end == count;
+
+    if (!valid)
+        freeFlatAst(ast);
+
+    return valid;
+}
+
+bool isNamedDefinition(const flatAst_t *ast, uint32_t def, int name) { // DEF node whose name is the identifier name
+    assert(ast);
+
+    if (ast->nodes[def].type != DEF || ast->nodes[def].childCount != 2)
+        return false;
+
+    uint32_t id = getAstChild(ast, def, 1);
+    return id != AST_NIL && ast->nodes[id].type == ID && ast->nodes[id].id == name;
+}
+
+bool loadBinaryAst(const astFileView_t *view, flatAst_t *ast, idTable_t *identifiers) { // false if nodes are inconsistent
+    assert(view);
+    assert(view->header);
+
+    std::vector<int> ids;
+    if (!loadBinaryNodes(view, 0, view->header->nodesCount, ast, identifiers, &ids))
+        return false;
+
+    // The table of contents has to point at the functions it names
+    bool valid = true;
+    for (uint32_t i = 0; valid && i < view->header->definitionsCount; i++) {
+        const astFileDefinition_t *definition = view->definitions + i;
+
+        valid = view->nodes[definition->firstNode].size == definition->nodesCount &&
+                isNamedDefinition(ast, definition->firstNode, ids[definition->name]);
+    }
+
+    if (!valid)
+        freeFlatAst(ast);
+
+    return valid;
+}
+
+// Decodes the function of one table of contents entry alone, the rest of the nodes is not read
+bool loadAstDefinition(const astFileView_t *view, const astFileDefinition_t *definition, flatAst_t *ast,
+                       idTable_t *identifiers) { // false if the entry or its nodes are inconsistent
+    assert(view);
+    assert(view->header);
+    assert(definition);
+
+    std::vector<int> ids;
+    if (!loadBinaryNodes(view, definition->firstNode, definition->nodesCount, ast, identifiers, &ids))
+        return false;
+
+    // A name the subtree never used stays -1 and matches no node
+    if (view->nodes[definition->firstNode].size == definition->nodesCount &&
+        isNamedDefinition(ast, 0, ids[definition->name]))
+        return true;
+
+    freeFlatAst(ast);
+    return false;
+}
+
+#endif
@@ -2,7 +2,7 @@
 #define _DIGITS_
 
 const size_t DIGITS_NUM = 118;
-const char *digits[] = {"H",
+constexpr const char *digits[] = {"H",
                         "He",
                         "Li",
                         "Be",
@@ -120,4 +120,26 @@ const char *digits[] = {"H",
                         "Lv",
                         "Ts",
                         "Og"};
+
+// Element index by capital letter and optional lowercase letter (column 0 for one-letter symbols)
+
+struct elementTable_t {
+    signed char symbols[26][27];
+};
+
+constexpr elementTable_t makeElementTable() {
+    elementTable_t table = {};
+    for (int capital = 0; capital < 26; capital++)
+        for (int lower = 0; lower < 27; lower++)
+            table.symbols[capital][lower] = -1;
+
+    for (size_t i = 0; i < DIGITS_NUM; i++) {
+        int lower = digits[i][1] ? digits[i][1] - 'a' + 1 : 0;
+        table.symbols[digits[i][0] - 'A'][lower] = i;
+    }
+
+    return table;
+}
+
+constexpr elementTable_t elementTable = makeElementTable();
 #endif
\ No newline at end of file
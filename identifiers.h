@@ -0,0 +1,120 @@
+#ifndef _IDENTIFIERS_
+#define _IDENTIFIERS_
+
+#include <cstdlib>
+#include <cstring>
+
+// Identifier interning: open addressing table over dense ids.
+// Names are views into the source buffer (not NUL-terminated), so it has to outlive the table
+
+const int ID_TABLE_INITIAL_SLOTS = 1 << 10;
+
+struct idTable_t {
+    const char **names; // Dense id -> name
+    int *lengths; // Dense id -> name length
+    unsigned *hashes; // Dense id -> hash
+    int count;
+    int capacity;
+
+    int *slots; // id + 1, 0 if slot is empty
+    unsigned slotMask;
+};
+
+bool initIdTable(idTable_t *table) {
+    assert(table);
+
+    *table = {};
+    table->slots = (int *) calloc(ID_TABLE_INITIAL_SLOTS, sizeof(int));
+    table->slotMask = ID_TABLE_INITIAL_SLOTS - 1;
+
+    return table->slots;
+}
+
+void freeIdTable(idTable_t *table) {
+    assert(table);
+
+    free(table->names);
+    free(table->hashes);
+    free(table->lengths);
+    free(table->slots);
+
+    *table = {};
+}
+
+bool growIdSlots(idTable_t *table) {
+    assert(table);
+
+    unsigned slotsNum = (table->slotMask + 1) * 2;
+    auto slots = (int *) calloc(slotsNum, sizeof(int));
+    if (!slots)
+        return false;
+
+    // Stored hashes make rehashing independent of the names
+    for (int id = 0; id < table->count; id++) {
+        unsigned slot = table->hashes[id] & (slotsNum - 1);
+        while (slots[slot])
+            slot = (slot + 1) & (slotsNum - 1);
+        slots[slot] = id + 1;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->slotMask = slotsNum - 1;
+
+    return true;
+}
+
+bool growIdArrays(idTable_t *table) {
+    assert(table);
+
+    int capacity = table->capacity ? table->capacity * 2 : ID_TABLE_INITIAL_SLOTS / 2;
+
+    auto names = (const char **) realloc(table->names, sizeof(const char *) * capacity);
+    if (!names)
+        return false;
+    table->names = names;
+
+    auto hashes = (unsigned *) realloc(table->hashes, sizeof(unsigned) * capacity);
+    if (!hashes)
+        return false;
+    table->hashes = hashes;
+
+    auto lengths = (int *) realloc(table->lengths, sizeof(int) * capacity);
+    if (!lengths)
+        return false;
+    table->lengths = lengths;
+
+    table->capacity = capacity;
+
+    return true;
+}
+
+int internIdentifier(idTable_t *table, const char *name, int length, unsigned hash) { // Returns dense id or -1 if out of memory
+    assert(table);
+    assert(name);
+
+    unsigned slot = hash & table->slotMask;
+    while (int entry = table->slots[slot]) {
+        int id = entry - 1;
+        if (table->hashes[id] == hash && table->lengths[id] == length && memcmp(table->names[id], name, length) == 0)
+            return id;
+
+        slot = (slot + 1) & table->slotMask;
+    }
+
+    if (table->count == table->capacity && !growIdArrays(table))
+        return -1;
+
+    int id = table->count++;
+    table->names[id] = name;
+    table->hashes[id] = hash;
+    table->lengths[id] = length;
+    table->slots[slot] = id + 1;
+
+    if ((unsigned) table->count * 2 > table->slotMask + 1 && !growIdSlots(table))
+        return -1;
+
+    return id;
+}
+
+#endif
@@ -1,4 +1,3 @@
-
 #define KEYWORD(name) + 1
 
 const int KEYWORDS_NUMBER =
@@ -7,17 +6,130 @@ const int KEYWORDS_NUMBER =
 
 #undef KEYWORD
 
-char *keywords[] = {
+constexpr const char *keywords[] = {
 #define KEYWORD(name) #name,
 #include "keywordlist.h"
 };
 
 #undef KEYWORD
 
+constexpr int keywordLengths[] = {
+#define KEYWORD(name) sizeof(#name) - 1,
+#include "keywordlist.h"
+};
+
+#undef KEYWORD
+
 #define KEYWORD(name) name,
 
 enum KEYWORDS {
 #include "keywordlist.h"
 };
 
-#undef KEYWORD
\ No newline at end of file
+#undef KEYWORD
+
+// Perfect hash of keywords, seed is searched at compile time
+
+const int KEYWORD_TABLE_SIZE = 64;
+const unsigned KEYWORD_SEED_LIMIT = 1 << 16;
+
+constexpr unsigned keywordHashStep(unsigned hash, char c) {
+    return (hash ^ (unsigned char) c) * 16777619u;
+}
+
+constexpr unsigned keywordSlot(unsigned hash) {
+    return (hash ^ (hash >> 15)) % KEYWORD_TABLE_SIZE;
+}
+
+constexpr unsigned keywordHash(const char *name, int length, unsigned seed) {
+    unsigned hash = seed;
+    for (int i = 0; i < length; i++)
+        hash = keywordHashStep(hash, name[i]);
+
+    return keywordSlot(hash);
+}
+
+constexpr bool isKeywordSeedPerfect(unsigned seed) {
+    bool used[KEYWORD_TABLE_SIZE] = {};
+    for (int i = 0; i < KEYWORDS_NUMBER; i++) {
+        unsigned slot = keywordHash(keywords[i], keywordLengths[i], seed);
+        if (used[slot])
+            return false;
+        used[slot] = true;
+    }
+
+    return true;
+}
+
+constexpr unsigned findKeywordSeed() {
+    for (unsigned seed = 0; seed < KEYWORD_SEED_LIMIT; seed++)
+        if (isKeywordSeedPerfect(seed))
+            return seed;
+
+    return KEYWORD_SEED_LIMIT;
+}
+
+constexpr unsigned KEYWORD_SEED = findKeywordSeed();
+
+static_assert(KEYWORD_SEED != KEYWORD_SEED_LIMIT, "Keywords collide in perfect hash, enlarge KEYWORD_TABLE_SIZE");
+
+struct keywordTable_t {
+    signed char slots[KEYWORD_TABLE_SIZE];
+};
+
+constexpr keywordTable_t makeKeywordTable() {
+    keywordTable_t table = {};
+    for (int i = 0; i < KEYWORD_TABLE_SIZE; i++)
+        table.slots[i] = -1;
+
+    for (int i = 0; i < KEYWORDS_NUMBER; i++)
+        table.slots[keywordHash(keywords[i], keywordLengths[i], KEYWORD_SEED)] = i;
+
+    return table;
+}
+
+constexpr keywordTable_t keywordTable = makeKeywordTable();
+
+int getKeywordNum(const char *token, int length, unsigned hash) { // hash is keywordHashStep chain seeded with KEYWORD_SEED
+    assert(token);
+
+    int num = keywordTable.slots[keywordSlot(hash)];
+    if (num != -1 && keywordLengths[num] == length && memcmp(keywords[num], token, length) == 0)
+        return num;
+
+    return -1;
+}
+
+unsigned getWordHash(const char *word, int length) { // Same hash the lexer accumulates while scanning a word
+    assert(word);
+
+    unsigned hash = KEYWORD_SEED;
+    for (int i = 0; i < length; i++)
+        hash = keywordHashStep(hash, word[i]);
+
+    return hash;
+}
+
+// Binding power of binary operator keywords, higher binds tighter, 0 if keyword is not an operator
+
+struct bindingPowers_t {
+    unsigned char power[KEYWORDS_NUMBER];
+};
+
+constexpr bindingPowers_t makeBindingPowers() {
+    bindingPowers_t table = {};
+
+    table.power[sourer] = 1;
+    table.power[bitterer] = 1;
+    table.power[justlike] = 1;
+
+    table.power[add] = 2;
+    table.power[filter] = 2;
+
+    table.power[mix] = 3;
+    table.power[steal] = 3;
+
+    return table;
+}
+
+constexpr bindingPowers_t bindingPowers = makeBindingPowers();
@@ -0,0 +1,199 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+#include "keywords.h"
+
+#include "scanner.h"
+
+// Lexer microbenchmarks: whitespace and word scanners of every instruction set the CPU has, in bytes per cycle,
+// and keyword lookup by perfect hash against the linear strcmp search it replaced.
+// Numbers only mean something in an optimized build: cmake -DCMAKE_BUILD_TYPE=Release
+
+const size_t BENCH_BUFFER_SIZE = 16 << 20;
+const size_t BENCH_PADDING = 64; // Vector scanners read up to 31 bytes past the end of a run
+const int BENCH_REPEATS = 5; // Best run is reported
+const int BENCH_LOOKUPS = 1 << 20;
+
+uint64_t readCycles() { // Time stamp counter where there is one, nanoseconds otherwise
+#ifdef SCANNER_X86
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct namedScanner_t {
+    const char *name;
+    scanner_t scanner;
+};
+
+std::vector<namedScanner_t> getScanners() { // Every scanner the CPU can run
+    std::vector<namedScanner_t> scanners = {{"scalar", {skipSpacesScalar, skipWordScalar}}};
+
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        scanners.push_back({"SSE2", {skipSpacesSSE2, skipWordSSE2}});
+    if (__builtin_cpu_supports("avx2"))
+        scanners.push_back({"AVX2", {skipSpacesAVX2, skipWordAVX2}});
+#endif
+
+    return scanners;
+}
+
+// Runs of one class with random lengths in [1, 2 * averageRun - 1], each followed by a single separator
+char *makeRunsBuffer(const char *alphabet, char separator, int averageRun) {
+    auto buffer = (char *) calloc(BENCH_BUFFER_SIZE + BENCH_PADDING, 1);
+    if (!buffer)
+        return nullptr;
+
+    size_t alphabetSize = strlen(alphabet);
+    size_t pos = 0;
+    while (true) {
+        size_t run = 1 + rand() % (2 * averageRun - 1);
+        if (pos + run + 1 > BENCH_BUFFER_SIZE)
+            break;
+
+        for (size_t i = 0; i < run; i++)
+            buffer[pos++] = alphabet[rand() % alphabetSize];
+        buffer[pos++] = separator;
+    }
+
+    return buffer;
+}
+
+double scanRuns(const char *(*skip)(const char *), const char *buffer) { // Bytes per cycle of the best repeat
+    const char *end = buffer + strlen(buffer);
+
+    uint64_t best = UINT64_MAX;
+    for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        uint64_t started = readCycles();
+        for (const char *pos = buffer; pos < end; pos++) // Separator is stepped over like the lexer does
+            pos = skip(pos);
+
+        uint64_t cycles = readCycles() - started;
+        if (cycles < best)
+            best = cycles;
+    }
+
+    return (double) (end - buffer) / best;
+}
+
+bool benchScanners() {
+    const int AVERAGE_RUNS[] = {2, 8, 32, 128};
+
+    printf("%-8s %-12s %-8s %s\n", "scanner", "function", "run", "bytes/cycle");
+    for (int averageRun : AVERAGE_RUNS) {
+        char *spaces = makeRunsBuffer(" \t\n", 'x', averageRun);
+        char *words = makeRunsBuffer("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_", ' ', averageRun);
+        if (!spaces || !words) {
+            printf("Not enough memory for benchmark buffers\n");
+            free(spaces);
+            free(words);
+            return false;
+        }
+
+        for (const namedScanner_t &named : getScanners()) {
+            printf("%-8s %-12s %-8d %.3f\n", named.name, "skipSpaces", averageRun,
+                   scanRuns(named.scanner.skipSpaces, spaces));
+            printf("%-8s %-12s %-8d %.3f\n", named.name, "skipWord", averageRun,
+                   scanRuns(named.scanner.skipWord, words));
+        }
+
+        free(spaces);
+        free(words);
+    }
+
+    return true;
+}
+
+int getKeywordNumLinear(const char *token) { // Lookup before the perfect hash, kept as the reference
+    assert(token);
+
+    for (int i = 0; i < KEYWORDS_NUMBER; i++) {
+        if (strcmp(keywords[i], token) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool benchKeywords() {
+    // Half keywords, half identifiers of keyword-like lengths, as zero-terminated strings for the linear search
+    std::vector<char> text;
+    std::vector<int> starts;
+    std::vector<int> lengths;
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        starts.push_back(text.size());
+
+        if (i % 2) {
+            const char *keyword = keywords[rand() % KEYWORDS_NUMBER];
+            text.insert(text.end(), keyword, keyword + strlen(keyword));
+        } else {
+            int length = 2 + rand() % 12;
+            for (int c = 0; c < length; c++)
+                text.push_back('a' + rand() % 26);
+        }
+
+        lengths.push_back(text.size() - starts.back());
+        text.push_back('\0');
+    }
+
+    uint64_t bestLinear = UINT64_MAX;
+    uint64_t bestHash = UINT64_MAX;
+    long linearSum = 0;
+    long hashSum = 0;
+    for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        linearSum = 0;
+        uint64_t started = readCycles();
+        for (int i = 0; i < BENCH_LOOKUPS; i++)
+            linearSum += getKeywordNumLinear(text.data() + starts[i]);
+        uint64_t cycles = readCycles() - started;
+        if (cycles < bestLinear)
+            bestLinear = cycles;
+
+        // Hash is computed here, the lexer gets it from the same loop
+        hashSum = 0;
+        started = readCycles();
+        for (int i = 0; i < BENCH_LOOKUPS; i++) {
+            const char *word = text.data() + starts[i];
+            hashSum += getKeywordNum(word, lengths[i], getWordHash(word, lengths[i]));
+        }
+        cycles = readCycles() - started;
+        if (cycles < bestHash)
+            bestHash = cycles;
+    }
+
+    if (linearSum != hashSum) {
+        printf("Keyword lookups disagree\n");
+        return false;
+    }
+
+    printf("\n%-20s %s\n", "keyword lookup", "cycles/lookup");
+    printf("%-20s %.1f\n", "linear strcmp", (double) bestLinear / BENCH_LOOKUPS);
+    printf("%-20s %.1f\n", "perfect hash", (double) bestHash / BENCH_LOOKUPS);
+
+    return true;
+}
+
+int main() {
+#ifndef __OPTIMIZE__
+    printf("Built without optimization, numbers are not representative\n");
+#endif
+#ifndef SCANNER_X86
+    printf("No time stamp counter, cycles are nanoseconds\n");
+#endif
+
+    srand(1);
+    if (!benchScanners() || !benchKeywords())
+        return 1;
+
+    return 0;
+}
@@ -3,15 +3,36 @@
 #include <cassert>
 #include <cctype>
 #include <cstring>
+#include <cstdint>
+#include <climits>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
-#include "../Tree/Tree.h"
+#include "Tree.h"
 
 const char *input = "input.chem";
 const char *output = "output.ast";
+int lexThreads = 1;
+bool eagerLexing = false; // Tokenize the whole input and list the tokens before parsing
+bool pipelinedLexing = false; // Lex on a separate thread while parsing
+bool binaryOutput = false; // Write the AST in the binary format of astfile.h instead of text
+bool watchInput = false; // Keep running and recompile only the changed definitions whenever the input changes
+const char *dumpFile = nullptr; // Graphviz dump of the AST, only written when set
+int dumpDepth = 0; // Deeper nodes of the dump are drawn as "...", 0 for no limit
+int dumpSpineItems = -1; // Items drawn for every statement, definition and parameter list, -1 for all
+bool reloadAst = false; // Input is a saved text or binary AST to be written again, in the format selected by -b
+const char *reloadFunction = nullptr; // With -r, only this function of a binary AST is read and written
+int verbosity = 0; // 0 prints errors only, 1 adds progress and statistics, 2 also lists the tokens
+const char *traceFile = nullptr; // JSON Lines trace of the tokens and AST nodes, only written when set
 
 const int SPECIAL_SYMBOLS_LENGTH = 4;
-const char specialSymbols[] = {'(', ')', ';', ','};
+constexpr char specialSymbols[] = {'(', ')', ';', ','};
 
 enum SPECIAL_SYMBOLS {
     left,
@@ -24,18 +45,13 @@ enum SPECIAL_SYMBOLS {
 
 #include "keywords.h"
 
-enum TOKEN_TYPE {
-    END,
-    KEYWORD,
-    SPECIAL_SYMBOL,
-    IDENTIFIER,
-    NUMBER
-};
+#include "identifiers.h"
 
-struct token_t {
-    TOKEN_TYPE type;
-    int id;
-};
+#include "scanner.h"
+
+#include "tokens.h"
+
+#include "arena.h"
 
 enum NODE_TYPE {
     D,
@@ -61,692 +77,1896 @@ enum NODE_TYPE {
     RAMEXPLODE
 };
 
+const char *const NODE_TYPE_NAMES[] = {
+    "D", "DEF", "VARLIST", "ID", "P", "OP", "C", "B", "IF", "WHILE", "E", "ASSIGN", "VAR", "RETURN", "CALL",
+    "ARITHM_OP", "NUM", "INPUT", "OUTPUT", "EXPLODE", "RAMEXPLODE"
+};
+
 struct value_t {
     NODE_TYPE type;
     int id;
 };
 
-char **IDs = nullptr;
+#include "ast.h"
+
+#include "astfile.h"
+
+#include "writer.h"
+
+const size_t SOURCE_PADDING = 64; // Zero bytes readable past the end, lets the scanner use wide loads
+
+struct source_t {
+    char *data; // Always followed by SOURCE_PADDING zero bytes
+    size_t size;
+    size_t mappedSize; // 0 if data is heap buffer
+};
+
+enum LEX_STATUS {
+    LEX_DONE, // Reached the end of the range
+    LEX_FAILED,
+    LEX_PAUSED // Token limit reached, may be resumed
+};
+
+struct lexer_t {
+    const char *begin; // Token offsets are counted from here
+    const char *raw;
+    const char *end; // Words never cross it
+    idTable_t *identifiers;
+    int tokensNum; // Produced so far, including dropped ones
+};
+
+const int TOKEN_RING_SLOTS = 8;
+
+struct tokenChunk_t {
+    tokenStream_t tokens;
+    LEX_STATUS status; // LEX_PAUSED for every chunk but the last
+};
+
+struct tokenRing_t { // Lock-free single producer, single consumer queue of token chunks
+    tokenChunk_t slots[TOKEN_RING_SLOTS] = {};
+    std::atomic<unsigned> head{0}; // Chunks published by the lexer
+    std::atomic<unsigned> tail{0}; // Chunks released by the parser
+};
+
+struct tokenPipeline_t {
+    lexer_t lexer = {};
+    tokenRing_t ring;
+    std::atomic<bool> stop{false};
+    std::thread thread;
+};
 
-size_t getFilesize(FILE *f);
+const idTable_t *IDs = nullptr;
+thread_local arena_t *astArena = nullptr; // Owns the AST values of the compilation unit being parsed
+thread_local std::vector<uint32_t> *syntaxErrors = nullptr; // Source offsets of the errors met by the parser
 
 void parseArgs(int argc, char *argv[]);
 
-char *loadFile(const char *filename, size_t *fileSize = nullptr);
+bool loadSource(const char *filename, source_t *source);
+
+void freeSource(source_t *source);
+
+bool isLexable(const source_t *source);
+
+bool tokenize(const char *raw, size_t size, idTable_t *identifiers, tokenStream_t *stream, int threadsNum);
+
+bool openTokenStream(const char *raw, size_t size, idTable_t *identifiers, tokenStream_t *stream, lexer_t *lexer,
+                     tokenCursor_t *cursor);
+
+bool openTokenPipeline(const char *raw, size_t size, idTable_t *identifiers, tokenStream_t *stream,
+                       tokenPipeline_t *pipeline, tokenCursor_t *cursor);
+
+void closeTokenPipeline(tokenPipeline_t *pipeline);
+
+node_t *getB(tokenCursor_t *tokens);
+
+tree_t *getP(tokenCursor_t *tokens);
+
+tree_t *getPParallel(tokenStream_t *stream, int threadsNum);
 
-token_t *tokenize(char *raw, size_t size, char ***ids, int *tNum, int *idNum);
+int watchSource();
 
-node_t *getB(token_t **tokens);
+int convertAst();
 
-tree_t *getP(token_t *tokens);
+node_t *getCall(tokenCursor_t *tokens);
 
-node_t *getCall(token_t **tokens);
+node_t *getE(tokenCursor_t *tokens);
 
-node_t *getE(token_t **tokens);
+size_t saveASTree(const flatAst_t *ast, const char *filename);
 
-void saveASTree(tree_t *tree, const char *filename);
+void traceTokens(const tokenStream_t *tokens, const idTable_t *identifiers, writer_t *w);
 
-char *dumpNode(void *v) {
-    value_t *value = (value_t *) v;
+void traceAst(const flatAst_t *ast, const idTable_t *identifiers, writer_t *w);
+
+const char *dumpNode(const astNode_t *value, char *buffer, size_t size) { // Graphviz record label of a node
+    assert(value);
 
-    char *buffer = (char *) calloc(1024, sizeof(char));
     switch (value->type) {
-        case D:
-            sprintf(buffer, "{ DEFINITION }");
-            break;
-        case OP:
-            sprintf(buffer, "{ OPERATION }");
-            break;
+        case P:
+            return "{ PROGRAM }";
         case VARLIST:
-            sprintf(buffer, "{ VARLIST }");
-            break;
+            return "{ VARLIST }";
         case ID:
-            sprintf(buffer, "{ ID } | %s", IDs[value->id]);
-            break;
+            snprintf(buffer, size, "{ ID } | %.*s", IDs->lengths[value->id], IDs->names[value->id]);
+            return buffer;
         case C:
-            sprintf(buffer, "{ BRANCHING }");
-            break;
+            return "{ BRANCHING }";
         case B:
-            sprintf(buffer, "{ BLOCK }");
-            break;
+            return "{ BLOCK }";
         case DEF:
-            sprintf(buffer, "{ FUNCTION }");
-            break;
+            return "{ FUNCTION }";
         case IF:
-            sprintf(buffer, "{ IF }");
-            break;
+            return "{ IF }";
         case WHILE:
-            sprintf(buffer, "{ WHILE }");
-            break;
+            return "{ WHILE }";
         case ASSIGN:
-            sprintf(buffer, "{ = }");
-            break;
+            return "{ = }";
         case VAR:
-            sprintf(buffer, "{ VAR }");
-            break;
+            return "{ VAR }";
         case RETURN:
-            sprintf(buffer, "{ RETURN }");
-            break;
+            return "{ RETURN }";
         case CALL:
-            sprintf(buffer, "{ CALL }");
-            break;
+            return "{ CALL }";
         case ARITHM_OP:
             switch(value->id) {
                 case sourer:
-                    sprintf(buffer, "{ \\< }");
-                    break;
+                    return "{ \\< }";
 
                 case bitterer:
-                    sprintf(buffer, "{ \\> }");
-                    break;
+                    return "{ \\> }";
 
                 case justlike:
-                    sprintf(buffer, "{ == }");
-                    break;
+                    return "{ == }";
 
                 case mix:
-                    sprintf(buffer, "{ * }");
-                    break;
+                    return "{ * }";
 
                 case steal:
-                    sprintf(buffer, "{ / }");
-                    break;
+                    return "{ / }";
 
                 case add:
-                    sprintf(buffer, "{ + }");
-                    break;
+                    return "{ + }";
 
                 case filter:
-                    sprintf(buffer, "{ - }");
-                    break;
+                    return "{ - }";
 
                 case sqrt:
-                    sprintf(buffer, "{ sqrt }");
-                    break;
+                    return "{ sqrt }";
             }
             break;
         case NUM:
-            sprintf(buffer, "{ INTEGER: %d }", value->id);
-            break;
+            snprintf(buffer, size, "{ INTEGER: %d }", value->id);
+            return buffer;
         case INPUT:
-            sprintf(buffer, "{ INPUT }");
-            break;
+            return "{ INPUT }";
         case OUTPUT:
-            sprintf(buffer, "{ OUTPUT }");
-            break;
+            return "{ OUTPUT }";
     }
 
-    return buffer;
+    return "";
 }
 
-int main(int argc, char *argv[]) {
-    parseArgs(argc, argv);
-    size_t progSize = 0;
-    char *raw_input = loadFile(input, &progSize);
+const size_t DUMP_LABEL_SIZE = 1024;
+
+struct dumpItem_t {
+    uint32_t node;
+    int depth;
+};
 
-    printf("Input filename: %s\nOutput filename: %s\n", input, output);
-    char **identifiers = nullptr;
+// Graphviz. Lists are drawn with their items as direct children, at most maxItems of them unless it is -1
+bool dumpFlatAst(const flatAst_t *ast, const char *filename, int maxDepth, int maxItems) {
+    assert(ast);
+    assert(filename);
 
-    printf("Performing text tokenizing...\n");
-    int tokenNum = 0;
-    int identifierNum = 0;
+    FILE *f = fopen(filename, "w");
+    if (!f)
+        return false;
 
-    token_t *tokens = tokenize(raw_input, progSize, &identifiers, &tokenNum, &identifierNum);
-    printf("Found %d tokens, %d identifiers.\nList of program tokens:\n", tokenNum, identifierNum);
-    for (int i = 0; i < tokenNum; i++) {
-        printf("%d:\t", i);
-        switch (tokens[i].type) {
-            case NUMBER:
-                printf("NUMBER\t\t%d", tokens[i].id);
-                break;
-            case IDENTIFIER:
-                printf("IDENTIFIER\t%s", identifiers[tokens[i].id]);
-                break;
-            case KEYWORD:
-                printf("KEYWORD\t\t%s", keywords[tokens[i].id]);
-                break;
-            case SPECIAL_SYMBOL:
-                printf("SYMBOL\t\t%c", specialSymbols[tokens[i].id]);
-                break;
+    fprintf(f, "digraph {\nconcentrate=true\n");
+
+    char label[DUMP_LABEL_SIZE];
+    std::vector<dumpItem_t> stack;
+    if (ast->nodesCount)
+        stack.push_back({0, 0});
+
+    while (!stack.empty()) {
+        dumpItem_t item = stack.back();
+        stack.pop_back();
+
+        uint32_t index = item.node;
+        const astNode_t *node = ast->nodes + index;
+        if (maxDepth && item.depth > maxDepth) {
+            fprintf(f, "node%u[shape=plaintext, label=\"...\"];\n", index);
+            continue;
+        }
+
+        const char *text = dumpNode(node, label, sizeof(label));
+        const char *color = index ? "springgreen" : "mediumturquoise";
+
+        if (isAstList(node->type)) {
+            uint32_t shown = node->childCount;
+            if (maxItems >= 0 && (uint32_t) maxItems < shown)
+                shown = maxItems;
+
+            fprintf(f, "node%u[shape=record, label=\"{%u | %s | %u ITEMS, %u SHOWN}\", style=filled, fillcolor=%s];\n",
+                    index, index, text, node->childCount, shown, color);
+
+            // First item has to be drawn first
+            for (uint32_t i = shown; i > 0; i--) {
+                uint32_t child = getAstChild(ast, index, i - 1);
+                if (child == AST_NIL)
+                    continue;
+
+                fprintf(f, "node%u -> node%u;\n", index, child);
+                stack.push_back({child, item.depth + 1});
+            }
+            continue;
+        }
+
+        uint32_t left = node->childCount ? getAstChild(ast, index, 0) : AST_NIL;
+        uint32_t right = node->childCount ? getAstChild(ast, index, 1) : AST_NIL;
+        fprintf(f, "node%u[shape=record, label=\"{%u | %s | {{LEFT |<left> %d} | {RIGHT |<right> %d}}}\", "
+                   "style=filled, fillcolor=%s];\n",
+                index, index, text, left == AST_NIL ? -1 : (int) left, right == AST_NIL ? -1 : (int) right, color);
+
+        if (right != AST_NIL) {
+            fprintf(f, "node%u:right -> node%u;\n", index, right);
+            stack.push_back({right, item.depth + 1});
+        }
+        if (left != AST_NIL) {
+            fprintf(f, "node%u:left -> node%u[color=indianred];\n", index, left);
+            stack.push_back({left, item.depth + 1});
         }
-        printf("\n");
     }
 
-    IDs = identifiers;
+    fprintf(f, "}\n");
 
-    tree_t *ASTree = getP(tokens);
-    treeDump(ASTree, "dump.dot", dumpNode);
-    saveASTree(ASTree, output);
+    return fclose(f) == 0;
 }
 
-void saveASNode(node_t *node, FILE *f) {
-    assert(f);
+int main(int argc, char *argv[]) {
+    parseArgs(argc, argv);
+    if (watchInput)
+        return watchSource();
+    if (reloadAst)
+        return convertAst();
+
+    source_t source = {};
+    if (!loadSource(input, &source)) {
+        printf("Unable to read input file %s\n", input);
+        return 1;
+    }
+    if (!isLexable(&source))
+        return 1;
+
+    if (verbosity >= 1)
+        printf("Input filename: %s\nOutput filename: %s\n", input, output);
+    idTable_t identifiers = {};
+    if (!initIdTable(&identifiers)) {
+        printf("Not enough memory for identifiers\n");
+        return 1;
+    }
 
-    fprintf(f, "{ ");
+    writer_t trace = {};
+    if (traceFile && !openWriter(&trace, traceFile)) {
+        printf("Unable to write trace file %s\n", traceFile);
+        return 1;
+    }
 
-    if(!node) {
-        fprintf(f, "@ } ");
-        return;
+    tokenStream_t tokens = {};
+    lexer_t lexer = {};
+    tokenPipeline_t pipeline;
+    tokenCursor_t cursor = {};
+
+    if (eagerLexing || lexThreads > 1 || traceFile) { // The trace needs the whole stream
+        if (verbosity >= 1)
+            printf("Performing text tokenizing...\n");
+        if (!tokenize(source.data, source.size, &identifiers, &tokens, lexThreads))
+            return 1;
+
+        if (verbosity >= 1)
+            printf("Found %d tokens, %d identifiers.\n", tokens.count, identifiers.count);
+        if (traceFile)
+            traceTokens(&tokens, &identifiers, &trace);
+
+        if (verbosity >= 2)
+            printf("List of program tokens:\n");
+        for (int i = 0; verbosity >= 2 && i < tokens.count; i++) {
+            int id = getTokenId(&tokens, i);
+            printf("%d:\t", i);
+            switch (getTokenType(&tokens, i)) {
+                case NUMBER:
+                    printf("NUMBER\t\t%d", id);
+                    break;
+                case IDENTIFIER:
+                    printf("IDENTIFIER\t%.*s", identifiers.lengths[id], identifiers.names[id]);
+                    break;
+                case KEYWORD:
+                    printf("KEYWORD\t\t%s", keywords[id]);
+                    break;
+                case SPECIAL_SYMBOL:
+                    printf("SYMBOL\t\t%c", specialSymbols[id]);
+                    break;
+            }
+            printf("\n");
+        }
+
+        cursor = makeTokenCursor(&tokens);
+    } else if (pipelinedLexing) {
+        if (verbosity >= 1)
+            printf("Performing pipelined tokenizing and parsing...\n");
+        if (!openTokenPipeline(source.data, source.size, &identifiers, &tokens, &pipeline, &cursor))
+            return 1;
+    } else {
+        if (verbosity >= 1)
+            printf("Performing streaming tokenizing and parsing...\n");
+        if (!openTokenStream(source.data, source.size, &identifiers, &tokens, &lexer, &cursor))
+            return 1;
+    }
+
+    IDs = &identifiers;
+
+    arena_t arena = {};
+    astArena = &arena;
+
+    tree_t *ASTree = lexThreads > 1 ? getPParallel(&tokens, lexThreads) : getP(&cursor);
+    closeTokenPipeline(&pipeline);
+    if (!ASTree || cursor.failed) {
+        if (traceFile) // Tokens of a program that does not parse are still worth keeping
+            closeWriter(&trace);
+        return 1;
+    }
+
+    if (!eagerLexing && lexThreads == 1 && !traceFile && verbosity >= 1) {
+        int tokensNum = pipelinedLexing ? pipeline.lexer.tokensNum : lexer.tokensNum;
+        printf("Parsed %d tokens, %d identifiers.\n", tokensNum, identifiers.count);
+    }
+
+    // Parser still builds the pointer tree and flattenTree converts it, so tokens go first to lower the peak,
+    // and nodes and values as soon as the flat AST has taken over
+    freeTokenStream(&tokens);
+
+    flatAst_t ast = {};
+    if (!flattenTree(ASTree, &ast)) {
+        printf("Not enough memory for AST\n");
+        return 1;
+    }
+    freeTree(ASTree);
+    releaseNodePool(); // Workers of -j have handed their slabs over, every node is gone with this
+    freeArena(&arena);
+
+    if (dumpFile && !dumpFlatAst(&ast, dumpFile, dumpDepth, dumpSpineItems))
+        printf("Unable to write dump file %s\n", dumpFile);
+
+    if (traceFile) {
+        traceAst(&ast, &identifiers, &trace);
+        if (!closeWriter(&trace))
+            printf("Unable to write trace file %s\n", traceFile);
+    }
+
+    if (!binaryOutput) {
+        auto started = std::chrono::steady_clock::now();
+        size_t size = saveASTree(&ast, output);
+        if (!size) {
+            printf("Unable to write output file %s\n", output);
+            return 1;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        if (verbosity >= 1)
+            printf("Wrote %zu bytes of AST in %.3f ms, %.1f MB/s\n", size, seconds * 1000, size / seconds / 1e6);
+    } else if (!saveBinaryAst(&ast, &identifiers, output)) {
+        printf("Unable to write output file %s\n", output);
+        return 1;
     }
 
+    freeFlatAst(&ast);
+    freeIdTable(&identifiers);
+    freeSource(&source);
+}
 
+void saveASName(const astNode_t *v, writer_t *w) {
+    assert(v);
+    assert(w);
 
-    auto v = (value_t *) node->value;
     switch (v->type) {
         case D:
-            fprintf(f, "DECLARATION ");
+            writeText(w, "DECLARATION ");
             break;
         case ID:
-            fprintf(f, "%s ", IDs[v->id]);
+            writeBytes(w, IDs->names[v->id], IDs->lengths[v->id]);
+            writeText(w, " ");
             break;
         case NUM:
-            fprintf(f, "%d ", v->id);
+            writeInt(w, v->id);
+            writeText(w, " ");
             break;
         case IF:
-            fprintf(f, "IF ");
+            writeText(w, "IF ");
             break;
         case WHILE:
-            fprintf(f, "WHILE ");
+            writeText(w, "WHILE ");
             break;
         case DEF:
-            fprintf(f, "FUNCTION ");
+            writeText(w, "FUNCTION ");
             break;
         case VARLIST:
-            fprintf(f, "VARLIST ");
+            writeText(w, "VARLIST ");
             break;
         case OP:
-            fprintf(f, "OP ");
+            writeText(w, "OP ");
             break;
         case ASSIGN:
-            fprintf(f, "ASSIGN ");
+            writeText(w, "ASSIGN ");
             break;
         case RETURN:
-            fprintf(f, "RETURN ");
+            writeText(w, "RETURN ");
             break;
         case VAR:
-            fprintf(f, "INITIALIZE ");
+            writeText(w, "INITIALIZE ");
             break;
         case CALL:
-            fprintf(f, "CALL ");
+            writeText(w, "CALL ");
             break;
         case INPUT:
-            fprintf(f, "INPUT ");
+            writeText(w, "INPUT ");
             break;
         case OUTPUT:
-            fprintf(f, "OUTPUT ");
+            writeText(w, "OUTPUT ");
             break;
         case P:
-            fprintf(f, "PROGRAM_ROOT ");
+            writeText(w, "PROGRAM_ROOT ");
             break;
         case C:
-            fprintf(f, "C ");
+            writeText(w, "C ");
             break;
         case B:
-            fprintf(f, "BLOCK ");
+            writeText(w, "BLOCK ");
             break;
         case EXPLODE:
-            fprintf(f, "EXPLODE ");
+            writeText(w, "EXPLODE ");
             break;
         case RAMEXPLODE:
-            fprintf(f, "RAMEXPLODE ");
+            writeText(w, "RAMEXPLODE ");
             break;
         case ARITHM_OP:
             switch (v->id) {
                 case sourer:
-                    fprintf(f, "BELOW ");
+                    writeText(w, "BELOW ");
                     break;
                 case bitterer:
-                    fprintf(f, "ABOVE ");
+                    writeText(w, "ABOVE ");
                     break;
                 case justlike:
-                    fprintf(f, "EQUAL ");
+                    writeText(w, "EQUAL ");
                     break;
                 case mix:
-                    fprintf(f, "MUL ");
+                    writeText(w, "MUL ");
                     break;
                 case steal:
-                    fprintf(f, "DIV ");
+                    writeText(w, "DIV ");
                     break;
                 case add:
-                    fprintf(f, "ADD ");
+                    writeText(w, "ADD ");
                     break;
                 case filter:
-                    fprintf(f, "SUB ");
+                    writeText(w, "SUB ");
                     break;
 
                 case sqrt:
-                    fprintf(f, "SQR ");
+                    writeText(w, "SQR ");
                     break;
             }
             break;
     }
+}
+
+struct saveItem_t {
+    uint32_t node;
+    bool close; // Write "} " instead of the node
+};
+
+void saveASNode(const flatAst_t *ast, uint32_t index, std::vector<saveItem_t> *stack, writer_t *w) { // Opens node, schedules the rest
+    assert(ast);
+    assert(stack);
+    assert(w);
+
+    writeText(w, "{ ");
+
+    if (index == AST_NIL) {
+        writeText(w, "@ } ");
+        return;
+    }
+
+    const astNode_t *v = ast->nodes + index;
+    saveASName(v, w);
+
+    stack->push_back({index, true});
+
+    if (!isAstList(v->type)) {
+        if (v->childCount) {
+            stack->push_back({getAstChild(ast, index, 1), false});
+            stack->push_back({getAstChild(ast, index, 0), false});
+        }
+
+        return;
+    }
+
+    // List items are written back as the left-linked spine
+    int count = v->childCount;
+    if (!count)
+        return;
 
-    if (node->left || node->right) {
-        saveASNode(node->left, f);
-        saveASNode(node->right, f);
+    // Statements and definitions hang their spine on the right, a VARLIST node is the first link itself
+    const char *link = v->type == B ? "{ OP " : "{ DECLARATION ";
+    int opened = count;
+    if (v->type == VARLIST) {
+        link = "{ VARLIST ";
+        opened = count - 1;
+    } else {
+        writeText(w, "{ @ } ");
     }
 
-    fprintf(f, "} ");
+    size_t linkLength = strlen(link);
+    for (int i = 0; i < opened; i++)
+        writeBytes(w, link, linkLength);
+    writeText(w, "{ @ } ");
+
+    // Innermost link holds the last statement or parameter, but the first definition
+    for (int i = count - 1; i >= 0; i--) {
+        if (i < opened)
+            stack->push_back({index, true});
 
+        int item = v->type == P ? i : count - 1 - i;
+        stack->push_back({getAstChild(ast, index, item), false});
+    }
 }
 
-void saveASTree(tree_t *tree, const char *filename) {
-    assert(tree);
+size_t saveASTree(const flatAst_t *ast, const char *filename) { // Bytes written, 0 on failure
+    assert(ast);
     assert(filename);
 
-    FILE *f = fopen(filename, "w");
-    saveASNode(tree->head, f);
-    fclose(f);
+    writer_t w = {};
+    if (!openWriter(&w, filename)) {
+        closeWriter(&w);
+        return 0;
+    }
+
+    // Explicit stack, so the depth of the tree costs no recursion; its memory is kept for the next call
+    thread_local std::vector<saveItem_t> stack;
+    stack.clear();
+    stack.push_back({0, false});
+    while (!stack.empty()) {
+        saveItem_t item = stack.back();
+        stack.pop_back();
+
+        if (item.close)
+            writeText(&w, "} ");
+        else
+            saveASNode(ast, item.node, &stack, &w);
+    }
 
+    size_t size = w.written + w.used;
+    return closeWriter(&w) ? size : 0;
 }
 
-value_t *makeValue(NODE_TYPE type, int id) {
-    auto val = (value_t *) calloc(1, (sizeof(value_t)));
-    val->type = type;
-    val->id = id;
+// Traces are JSON Lines, one object per token or node. Keywords, symbols and node types are written as they are,
+// identifiers are escaped since a loaded AST may name them with any bytes
 
-    return val;
-}
+void traceTokens(const tokenStream_t *tokens, const idTable_t *identifiers, writer_t *w) {
+    assert(tokens);
+    assert(identifiers);
+    assert(w);
 
-void parseArgs(int argc, char *argv[]) {
-    int res = 0;
-    while ((res = getopt(argc, argv, "i:o:")) != -1) {
-        switch (res) {
-            case 'i':
-                input = optarg;
+    for (int i = 0; i < tokens->count; i++) {
+        int id = getTokenId(tokens, i);
+
+        writeText(w, "{\"event\":\"token\",\"index\":");
+        writeInt(w, i);
+        writeText(w, ",\"offset\":");
+        writeUnsigned(w, tokens->offsets[i]);
+
+        switch (getTokenType(tokens, i)) {
+            case NUMBER:
+                writeText(w, ",\"type\":\"NUMBER\",\"value\":");
+                writeInt(w, id);
+                writeText(w, "}\n");
+                continue;
+            case IDENTIFIER:
+                writeText(w, ",\"type\":\"IDENTIFIER\",\"text\":\"");
+                writeJsonEscaped(w, identifiers->names[id], identifiers->lengths[id]);
                 break;
-            case 'o':
-                output = optarg;
+            case KEYWORD:
+                writeText(w, ",\"type\":\"KEYWORD\",\"text\":\"");
+                writeBytes(w, keywords[id], strlen(keywords[id]));
                 break;
-            case '?':
-                printf("Invalid argument found!\n");
+            case SPECIAL_SYMBOL:
+                writeText(w, ",\"type\":\"SYMBOL\",\"text\":\"");
+                writeBytes(w, specialSymbols + id, 1);
+                break;
+            case END:
                 break;
         }
+        writeText(w, "\"}\n");
     }
 }
 
-char *skipSpaces(char *str) {
-    assert(str);
-
-    while (isspace(*str))
-        str++;
-
-    return str;
-}
-
-char *parseToken(char *raw, int *length) {
-    int len = 0;
-    if (isalpha(*raw) || *raw == '_') {
-        while (isalpha(*(raw + len)) || *(raw + len) == '_')
-            len++;
+void traceAst(const flatAst_t *ast, const idTable_t *identifiers, writer_t *w) { // Nodes in preorder, absent children are null
+    assert(ast);
+    assert(identifiers);
+    assert(w);
+
+    for (int i = 0; i < ast->nodesCount; i++) {
+        const astNode_t *node = ast->nodes + i;
+        const char *type = NODE_TYPE_NAMES[node->type];
+
+        writeText(w, "{\"event\":\"node\",\"index\":");
+        writeInt(w, i);
+        writeText(w, ",\"type\":\"");
+        writeBytes(w, type, strlen(type));
+        writeText(w, "\"");
+
+        switch (node->type) {
+            case ID:
+                writeText(w, ",\"name\":\"");
+                writeJsonEscaped(w, identifiers->names[node->id], identifiers->lengths[node->id]);
+                writeText(w, "\"");
+                break;
+            case NUM:
+                writeText(w, ",\"value\":");
+                writeInt(w, node->id);
+                break;
+            case ARITHM_OP:
+                writeText(w, ",\"operator\":\"");
+                writeBytes(w, keywords[node->id], strlen(keywords[node->id]));
+                writeText(w, "\"");
+                break;
+            default:
+                break;
+        }
 
-        auto token = (char *) calloc(len, sizeof(char));
-        strncpy(token, raw, len);
-        *length = len;
-        return token;
-    } else {
+        writeText(w, ",\"children\":[");
+        for (uint32_t child = 0; child < node->childCount; child++) {
+            if (child)
+                writeText(w, ",");
 
-        for (int i = 0; i < SPECIAL_SYMBOLS_LENGTH; i++) {
-            if (specialSymbols[i] == *raw) {
-                auto token = (char *) calloc(len, sizeof(char));
-                strncpy(token, raw, 1);
-                *length = 1;
-                return token;
-            }
+            uint32_t index = getAstChild(ast, i, child);
+            if (index == AST_NIL)
+                writeText(w, "null");
+            else
+                writeUnsigned(w, index);
         }
-
-        return nullptr;
+        writeText(w, "]}\n");
     }
 }
 
-int getKeywordNum(char *token) {
-    assert(token);
+struct astName_t {
+    const char *name;
+    NODE_TYPE type;
+    int id;
+};
 
-    for (int i = 0; i < KEYWORDS_NUMBER; i++) {
-        if (strcmp(keywords[i], token) == 0) {
-            return i;
-        }
-    }
+constexpr astName_t AST_NAMES[] = { // Names written by saveASName, D and OP only appear as spine links
+    {"IF", IF, 0}, {"WHILE", WHILE, 0}, {"FUNCTION", DEF, 0}, {"VARLIST", VARLIST, 0}, {"ASSIGN", ASSIGN, 0},
+    {"RETURN", RETURN, 0}, {"INITIALIZE", VAR, 0}, {"CALL", CALL, 0}, {"INPUT", INPUT, 0}, {"OUTPUT", OUTPUT, 0},
+    {"PROGRAM_ROOT", P, 0}, {"C", C, 0}, {"BLOCK", B, 0}, {"EXPLODE", EXPLODE, 0}, {"RAMEXPLODE", RAMEXPLODE, 0},
+    {"BELOW", ARITHM_OP, sourer}, {"ABOVE", ARITHM_OP, bitterer}, {"EQUAL", ARITHM_OP, justlike},
+    {"MUL", ARITHM_OP, mix}, {"DIV", ARITHM_OP, steal}, {"ADD", ARITHM_OP, add}, {"SUB", ARITHM_OP, filter},
+    {"SQR", ARITHM_OP, sqrt}
+};
+
+struct astReader_t {
+    const char *begin;
+    const char *pos; // Text has to be followed by a zero byte
+};
 
-    return -1;
+inline bool isAstSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
 }
 
-int getSpecialSymbolNum(char *token) {
-    for (int i = 0; i < SPECIAL_SYMBOLS_LENGTH; i++)
-        if (*token == specialSymbols[i] && !*(token + 1))
-            return i;
+inline char peekAst(astReader_t *reader) { // Next significant character, '\0' at the end
+    while (isAstSpace(*reader->pos))
+        reader->pos++;
 
-    return -1;
+    return *reader->pos;
 }
 
-int parseNumber(char *token, bool *success) {
-    assert(token);
-    assert(success);
+inline bool expectAst(astReader_t *reader, char c) {
+    if (peekAst(reader) != c)
+        return false;
 
-    *success = false;
-    int parsed = 0;
-    int len = 0;
-    char tmp = 0;
-    while (*token != '\0') {
-        if (islower(*token)) return 0;
-        else {
-            len = 1;
-            while (islower(*(token + len))) len++;
-            tmp = *(token + len);
-            *(token + len) = '\0';
-            for (int i = 0; i < DIGITS_NUM; i++) {
-                if (strcmp(token, digits[i]) == 0) {
-                    parsed = parsed * DIGITS_NUM + i;
-                    token += len;
-                    *token = tmp;
-                    len = 0;
-                }
-            }
-            if (len)
-                return 0;
-        }
-    }
-    *success = true;
-    return parsed;
+    reader->pos++;
+    return true;
 }
 
-char **findIdentifier(char **ids, char *id) {
-    assert(ids);
-    assert(id);
+inline int readAstWord(astReader_t *reader, const char **word, unsigned *hash) { // Length, 0 if there is no word
+    peekAst(reader);
 
-    while (*ids) {
-        if (strcmp(*ids, id) == 0)
-            return ids;
+    const char *start = reader->pos;
+    unsigned wordHash = KEYWORD_SEED;
+    while (*reader->pos && !isAstSpace(*reader->pos) && *reader->pos != '{' && *reader->pos != '}')
+        wordHash = keywordHashStep(wordHash, *reader->pos++);
 
-        ids++;
-    }
-    return ids;
+    *word = start;
+    *hash = wordHash;
+    return reader->pos - start;
 }
 
-void makeToken(token_t *token, TOKEN_TYPE type, int id) {
-    token->type = type;
-    token->id = id;
+bool isAstWord(const char *word, int length, const char *expected) {
+    return strncmp(word, expected, length) == 0 && expected[length] == '\0';
 }
 
-void addKeywordToken(token_t *tokens, int *tokenNum, int keywordID) {
-    assert(tokens);
-    assert(tokenNum);
+const unsigned AST_NAME_SLOTS = 64;
 
-    makeToken(tokens + *tokenNum, KEYWORD, keywordID);
-    (*tokenNum)++;
-}
+struct astNameTable_t {
+    signed char slots[AST_NAME_SLOTS]; // Index in AST_NAMES, open addressing by getWordHash
+};
 
-void addSpecialSymbolToken(token_t *tokens, int *tokenNum, int specialSymbolID) {
-    assert(tokens);
-    assert(tokenNum);
+constexpr astNameTable_t makeAstNameTable() {
+    astNameTable_t table = {};
+    for (unsigned i = 0; i < AST_NAME_SLOTS; i++)
+        table.slots[i] = -1;
 
-    makeToken(tokens + *tokenNum, SPECIAL_SYMBOL, specialSymbolID);
-    (*tokenNum)++;
-}
+    for (unsigned i = 0; i < sizeof(AST_NAMES) / sizeof(AST_NAMES[0]); i++) {
+        unsigned hash = KEYWORD_SEED;
+        for (const char *c = AST_NAMES[i].name; *c; c++)
+            hash = keywordHashStep(hash, *c);
 
-void addIntegerToken(token_t *tokens, int *tokenNum, int integer) {
-    assert(tokens);
-    assert(tokenNum);
+        unsigned slot = hash % AST_NAME_SLOTS;
+        while (table.slots[slot] != -1)
+            slot = (slot + 1) % AST_NAME_SLOTS;
+        table.slots[slot] = i;
+    }
 
-    makeToken(tokens + *tokenNum, NUMBER, integer);
-    (*tokenNum)++;
+    return table;
 }
 
-void addIdentifierToken(token_t *tokens, char **identifiers, int *tokenNum, int *identifierNum, char *token) {
-    assert(tokens);
-    assert(token);
-    assert(tokenNum);
+constexpr astNameTable_t astNameTable = makeAstNameTable();
 
-    char **id = findIdentifier(identifiers, token);
-    if (*id) {
-        makeToken(tokens + *tokenNum, IDENTIFIER, id - identifiers);
-    } else {
-        int len = strlen(token);
-        if (strcmp(token, "main_babka_labka") == 0) {
-            *(identifiers + *identifierNum) = "main";
-        }
-        else {
-            auto string = (char *) calloc(len, sizeof(char));
-            strcpy(string, token);
-            *(identifiers + *identifierNum) = string;
-        }
-        makeToken(tokens + *tokenNum, IDENTIFIER, *identifierNum);
-        (*identifierNum)++;
-    }
-    (*tokenNum)++;
+bool readAstNil(astReader_t *reader) { // "{ @ }"
+    const char *word = nullptr;
+    unsigned hash = 0;
+    return expectAst(reader, '{') && readAstWord(reader, &word, &hash) == 1 && *word == '@' && expectAst(reader, '}');
 }
 
-token_t *tokenize(char *raw, size_t size, char ***ids, int *tNum, int *idNum) {
-    assert(raw);
-
-    auto tokens = (token_t *) calloc(size, sizeof(token_t));
-    auto identifiers = (char **) calloc(size, sizeof(char *));
-    int tokenNum = 0;
-    int identifierNum = 0;
-
-    raw = skipSpaces(raw);
+bool getAstValue(const char *word, int length, unsigned hash, idTable_t *identifiers, value_t *value) {
+    if (*word == '-' || isdigit((unsigned char) *word)) {
+        char *end = nullptr;
+        long number = strtol(word, &end, 10);
+        if (end != word + length || number < INT_MIN || number > INT_MAX)
+            return false;
 
-    int len = 0;
+        *value = {NUM, (int) number};
+        return true;
+    }
 
-    while (*raw != '\0') {
-        char *substring = parseToken(raw, &len);
-        raw += len;
-        int num = 0;
-        if ((num = getKeywordNum(substring)) != -1) {
-            addKeywordToken(tokens, &tokenNum, num);
-        } else if ((num = getSpecialSymbolNum(substring)) != -1) {
-            addSpecialSymbolToken(tokens, &tokenNum, num);
-        } else {
-            bool success = false;
-            num = parseNumber(substring, &success);
-            if (success) {
-                addIntegerToken(tokens, &tokenNum, num);
-            } else {
-                addIdentifierToken(tokens, identifiers, &tokenNum, &identifierNum, substring);
-            }
+    for (unsigned slot = hash % AST_NAME_SLOTS; astNameTable.slots[slot] != -1; slot = (slot + 1) % AST_NAME_SLOTS) {
+        const astName_t *name = AST_NAMES + astNameTable.slots[slot];
+        if (isAstWord(word, length, name->name)) {
+            *value = {name->type, name->id};
+            return true;
         }
-        raw = skipSpaces(raw);
     }
 
-    tokens = (token_t *) realloc(tokens, sizeof(token_t) * (tokenNum + 1));
-    identifiers = (char **) realloc(identifiers, sizeof(char *) * (identifierNum + 1));
-
-    *ids = identifiers;
-    *tNum = tokenNum;
-    *idNum = identifierNum;
+    // Anything else is an identifier, so one spelled like a node name reads back as that node
+    int id = internIdentifier(identifiers, word, length, hash);
+    *value = {ID, id};
 
-    return tokens;
+    return id != -1;
 }
 
-size_t getFilesize(FILE *f) {
-    assert(f);
+enum LOAD_FRAME {
+    LOAD_BINARY, // Two child slots, then "}"
+    LOAD_LIST // Items each followed by "}", P and B close once more
+};
 
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+struct loadFrame_t {
+    LOAD_FRAME type;
+    uint32_t node;
+    uint32_t next; // Child slot or item being read
+    uint32_t count;
+    bool closing; // Item has been read, its "}" is pending
+};
 
-    return size;
+int countAstLinks(astReader_t *reader, const char *link) { // Spine links up to the innermost "{ @ }", -1 if malformed
+    int count = 0;
+    while (true) {
+        const char *word = nullptr;
+        unsigned hash = 0;
+        if (!expectAst(reader, '{'))
+            return -1;
+
+        int length = readAstWord(reader, &word, &hash);
+        if (length == 1 && *word == '@')
+            return expectAst(reader, '}') ? count : -1;
+
+        if (!isAstWord(word, length, link))
+            return -1;
+        count++;
+    }
 }
 
-char *loadFile(const char *filename, size_t *fileSize) {
-    assert(filename);
+bool readAstNode(astReader_t *reader, flatAst_t *ast, idTable_t *identifiers, int slot,
+                 std::vector<loadFrame_t> *frames) { // Opens node, schedules its children
+    if (!expectAst(reader, '{'))
+        return false;
 
-    FILE *input = fopen(filename, "r");
+    const char *word = nullptr;
+    unsigned hash = 0;
+    int length = readAstWord(reader, &word, &hash);
+    if (!length)
+        return false;
 
-    size_t size = getFilesize(input);
-    if (fileSize)
-        *fileSize = size;
+    if (length == 1 && *word == '@') {
+        if (slot == -1)
+            return false;
 
-    char *content = (char *) calloc(size, sizeof(char));
-    fread(content, sizeof(char), size, input);
+        ast->children[slot] = AST_NIL;
+        return expectAst(reader, '}');
+    }
 
-    fclose(input);
+    value_t value = {};
+    if (!getAstValue(word, length, hash, identifiers, &value))
+        return false;
 
-    return content;
-}
+    uint32_t node = addAstNode(ast, value.type, value.id);
+    if (node == AST_NIL)
+        return false;
+    if (slot != -1)
+        ast->children[slot] = node;
 
-node_t *getVarlist(token_t **tokens) {
-    assert(tokens);
+    if (expectAst(reader, '}'))
+        return true;
 
-    value_t *headVal = makeValue(VARLIST, 0);
-    node_t *head = makeNode(nullptr, nullptr, nullptr, headVal);
+    if (!isAstList(value.type)) {
+        if (!reserveAstChildren(ast, node, 2))
+            return false;
 
-    node_t *current = head;
+        frames->push_back({LOAD_BINARY, node, 0, 2, false});
+        return true;
+    }
 
-    while ((*tokens)->type == IDENTIFIER) {
-        value_t *idVal = makeValue(ID, (*tokens)->id);
-        value_t *varlistVal = makeValue(VARLIST, 0);
+    // Spine is read back into a list: P and B hang it on the right of an empty left child, VARLIST is its first link
+    int count = 0;
+    if (value.type == VARLIST) {
+        count = countAstLinks(reader, "VARLIST") + 1;
+    } else {
+        if (!readAstNil(reader))
+            return false;
 
-        node_t *idNode = makeNode(nullptr, nullptr, nullptr, idVal);
-        node_t *varlistNode = makeNode(current, nullptr, idNode, varlistVal);
-        current->left = varlistNode;
+        count = countAstLinks(reader, value.type == P ? "DECLARATION" : "OP");
+    }
 
-        current = varlistNode;
+    if (count <= 0 || !reserveAstChildren(ast, node, count))
+        return false;
 
-        (*tokens)++;
+    frames->push_back({LOAD_LIST, node, 0, (uint32_t) count, false});
+    return true;
+}
 
-        if ((*tokens)->type == SPECIAL_SYMBOL && (*tokens)->id == comma)
-            (*tokens)++;
+bool loadASTree(const char *text, size_t size, flatAst_t *ast, idTable_t *identifiers) { // text ends with a zero byte
+    assert(text);
+    assert(ast);
+    assert(identifiers);
+
+    // saveASTree spends at least "{ X } " on every node and empty child, so files it wrote never make the arrays grow;
+    // denser input such as "{x{a}{b}}" is still read, addAstNode and reserveAstChildren grow the arrays as needed
+    *ast = {};
+    if (!reserveFlatAst(ast, size / 6 + 1, size / 6 + 1)) {
+        printf("Not enough memory for AST\n");
+        return false;
     }
 
-    if(head->left) {
-        head = head->left;
-        head->parent = nullptr;
-    }
+    astReader_t reader = {text, text};
 
-    return head;
-}
+    // Explicit stack, so the depth of the tree costs no recursion
+    std::vector<loadFrame_t> frames;
+    bool loaded = readAstNode(&reader, ast, identifiers, -1, &frames);
 
-node_t *getId(token_t **tokens) {
-    assert(tokens);
+    while (loaded && !frames.empty()) {
+        loadFrame_t *frame = &frames.back();
 
-    if ((*tokens)->type == IDENTIFIER) {
-        value_t *val = makeValue(ID, (*tokens)->id);
-        node_t *node = makeNode(nullptr, nullptr, nullptr, val);
-        (*tokens)++;
+        if (frame->closing) {
+            frame->closing = false;
+            loaded = expectAst(&reader, '}');
+            continue;
+        }
 
-        return node;
-    }
+        if (frame->next < frame->count) {
+            // Innermost link holds the last statement or parameter, but the first definition
+            uint32_t item = frame->next++;
+            if (frame->type == LOAD_LIST && ast->nodes[frame->node].type != P)
+                item = frame->count - 1 - item;
 
-    return nullptr;
-}
+            frame->closing = frame->type == LOAD_LIST;
+            loaded = readAstNode(&reader, ast, identifiers, ast->nodes[frame->node].firstChild + item, &frames);
+            continue;
+        }
 
-node_t *getParenthesis(token_t **tokens) { // Parse parenthesis in arithmetic/logical equations (Function call, variable, parenthesis)
-    assert(tokens);
-    if ((*tokens)->type == SPECIAL_SYMBOL && (*tokens)->id == left) {
-        (*tokens)++;
-        node_t *subeq = getE(tokens);
+        // VARLIST is closed by the "}" of its last item
+        if (frame->type == LOAD_BINARY || ast->nodes[frame->node].type != VARLIST)
+            loaded = expectAst(&reader, '}');
+        frames.pop_back();
+    }
 
-        if (!subeq)
-            return nullptr;
+    // Zero byte before the end is not the end of the file, it is malformed like any other stray byte
+    if (loaded && peekAst(&reader) == '\0' && reader.pos == text + size && reorderAstPreorder(ast))
+        return true;
 
-        if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != right)
-            return nullptr;
-        (*tokens)++;
+    printf("Malformed AST near byte %zu\n", (size_t) (reader.pos - reader.begin));
+    freeFlatAst(ast);
 
-        return subeq;
-    } else if((*tokens)->type == KEYWORD) {
-        if((*tokens)->id == sqrt){
-            (*tokens)++;
+    return false;
+}
 
-            if (((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != left))
-                return nullptr;
-            (*tokens)++;
+int convertAst() { // Reads the input as a saved text or binary AST and writes it again
+    source_t source = {};
+    if (!loadSource(input, &source)) {
+        printf("Unable to read input file %s\n", input);
+        return 1;
+    }
 
-            node_t *exp= getE(tokens);
-            if (!exp)
-                return nullptr;
+    idTable_t identifiers = {};
+    if (!initIdTable(&identifiers)) {
+        printf("Not enough memory for identifiers\n");
+        return 1;
+    }
+    IDs = &identifiers;
+
+    auto started = std::chrono::steady_clock::now();
+    flatAst_t ast = {};
+
+    // Binary files are recognised by their magic, identifier names stay in their mapping until the end
+    astFileView_t view = {};
+    if (source.size >= sizeof(AST_FILE_MAGIC) && memcmp(source.data, AST_FILE_MAGIC, sizeof(AST_FILE_MAGIC)) == 0) {
+        bool loaded = openAstFile(input, &view);
+
+        // A single function is found through the table of contents, the other ones are not decoded
+        if (loaded && reloadFunction) {
+            const astFileDefinition_t *definition = findAstDefinition(&view, reloadFunction, strlen(reloadFunction));
+            if (!definition) {
+                printf("No function %s in %s\n", reloadFunction, input);
+                closeAstFile(&view);
+                return 1;
+            }
 
-            if (((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != right))
-                return nullptr;
-            (*tokens)++;
+            loaded = loadAstDefinition(&view, definition, &ast, &identifiers);
+        } else if (loaded) {
+            loaded = loadBinaryAst(&view, &ast, &identifiers);
+        }
+
+        if (!loaded) {
+            printf("Malformed binary AST %s\n", input);
+            closeAstFile(&view);
+            return 1;
+        }
+    } else if (reloadFunction) {
+        printf("Only a binary AST can be read one function at a time\n");
+        return 1;
+    } else if (!loadASTree(source.data, source.size, &ast, &identifiers)) {
+        return 1;
+    }
 
-            value_t *sqrtVal = makeValue(ARITHM_OP, sqrt);
-            node_t *sqrtNode = makeNode(nullptr, nullptr, exp, sqrtVal);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    if (verbosity >= 1)
+        printf("Loaded %zu bytes of AST, %d nodes, in %.3f ms, %.1f MB/s\n", source.size, ast.nodesCount, seconds * 1000,
+           source.size / seconds / 1e6);
+
+    if (traceFile) {
+        writer_t trace = {};
+        bool traced = openWriter(&trace, traceFile);
+        if (traced)
+            traceAst(&ast, &identifiers, &trace);
+        if (!closeWriter(&trace) || !traced)
+            printf("Unable to write trace file %s\n", traceFile);
+    }
+
+    bool saved = binaryOutput ? saveBinaryAst(&ast, &identifiers, output) : saveASTree(&ast, output) != 0;
+    if (!saved)
+        printf("Unable to write output file %s\n", output);
+
+    freeFlatAst(&ast);
+    freeIdTable(&identifiers);
+    closeAstFile(&view);
+    freeSource(&source);
+
+    return saved ? 0 : 1;
+}
+
+value_t *makeValue(NODE_TYPE type, int id) {
+    assert(astArena);
+
+    auto val = (value_t *) arenaAlloc(astArena, sizeof(value_t));
+    assert(val);
+
+    val->type = type;
+    val->id = id;
 
-            return sqrtNode;
+    return val;
+}
 
+void parseArgs(int argc, char *argv[]) {
+    int res = 0;
+    while ((res = getopt(argc, argv, "i:o:j:epwbrf:g:D:S:vt:")) != -1) {
+        switch (res) {
+            case 'i':
+                input = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'e':
+                eagerLexing = true;
+                break;
+            case 'p':
+                pipelinedLexing = true;
+                break;
+            case 'w':
+                watchInput = true;
+                break;
+            case 'b':
+                binaryOutput = true;
+                break;
+            case 'r':
+                reloadAst = true;
+                break;
+            case 'f':
+                reloadFunction = optarg;
+                break;
+            case 'g':
+                dumpFile = optarg;
+                break;
+            case 'D':
+                dumpDepth = atoi(optarg);
+                break;
+            case 'S':
+                dumpSpineItems = atoi(optarg);
+                break;
+            case 'v':
+                verbosity++;
+                break;
+            case 't':
+                traceFile = optarg;
+                break;
+            case 'j':
+                lexThreads = atoi(optarg);
+                if (lexThreads < 1)
+                    lexThreads = std::thread::hardware_concurrency();
+                if (lexThreads < 1)
+                    lexThreads = 1;
+                break;
+            case '?':
+                printf("Invalid argument found!\n");
+                break;
         }
-        else {
-            return nullptr;
+    }
+}
+
+enum CHAR_CLASS {
+    CLASS_OTHER, // Also '\0', only the size of the source ends it
+    CLASS_SPACE,
+    CLASS_SYMBOL,
+    CLASS_UPPER, // Word classes go last so that a single comparison detects them
+    CLASS_LOWER,
+    CLASS_UNDERSCORE
+};
+
+struct lexerTables_t {
+    unsigned char charClass[256];
+    signed char symbolId[256];
+};
+
+constexpr lexerTables_t makeLexerTables() {
+    lexerTables_t tables = {};
+    for (int c = 0; c < 256; c++) {
+        tables.symbolId[c] = -1;
+
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r')
+            tables.charClass[c] = CLASS_SPACE;
+        else if (c >= 'A' && c <= 'Z')
+            tables.charClass[c] = CLASS_UPPER;
+        else if (c >= 'a' && c <= 'z')
+            tables.charClass[c] = CLASS_LOWER;
+        else if (c == '_')
+            tables.charClass[c] = CLASS_UNDERSCORE;
+        else
+            tables.charClass[c] = CLASS_OTHER;
+    }
+
+    for (int i = 0; i < SPECIAL_SYMBOLS_LENGTH; i++) {
+        tables.charClass[(unsigned char) specialSymbols[i]] = CLASS_SYMBOL;
+        tables.symbolId[(unsigned char) specialSymbols[i]] = i;
+    }
+
+    return tables;
+}
+
+constexpr lexerTables_t lexerTables = makeLexerTables();
+
+int parseNumber(const char *token, int length, bool *success, bool *overflow) {
+    assert(token);
+    assert(success);
+    assert(overflow);
+
+    *success = false;
+    *overflow = false;
+    uint64_t parsed = 0;
+    bool tooLarge = false;
+    const char *end = token + length;
+    while (token < end) {
+        unsigned capital = (unsigned char) *token - 'A';
+        if (capital >= 26)
+            return 0;
+        token++;
+
+        unsigned lower = 0;
+        if (token < end && *token >= 'a' && *token <= 'z') {
+            lower = *token - 'a' + 1;
+            token++;
         }
-    } else if ((*tokens)->type == IDENTIFIER) {
-        if (!*(tokens + 1))
-            return nullptr;
 
-        if ((*(tokens) + 1)->type == SPECIAL_SYMBOL && (*(tokens) + 1)->id == left) {
+        int digit = elementTable.symbols[capital][lower];
+        if (digit == -1)
+            return 0;
+
+        if (!tooLarge) {
+            parsed = parsed * DIGITS_NUM + digit;
+            tooLarge = parsed > INT_MAX; // Keep validating the rest, it still may be an identifier
+        }
+    }
+
+    if (tooLarge) {
+        *overflow = true;
+        return 0;
+    }
+
+    *success = true;
+    return (int) parsed;
+}
+
+bool addIdentifierToken(tokenStream_t *stream, idTable_t *identifiers, const char *token, int len, unsigned hash,
+                        uint32_t offset) {
+    assert(stream);
+    assert(identifiers);
+    assert(token);
+
+    if (len == strlen("main_babka_labka") && memcmp(token, "main_babka_labka", len) == 0) {
+        token = "main";
+        len = strlen(token);
+        hash = getWordHash(token, len);
+    }
+
+    int id = internIdentifier(identifiers, token, len, hash);
+    if (id == -1)
+        return false;
+
+    return pushToken(stream, IDENTIFIER, id, offset);
+}
+
+lexer_t makeLexer(const char *begin, const char *start, const char *end, idTable_t *identifiers) {
+    return {begin, start, end, identifiers, 0};
+}
+
+LEX_STATUS lexRange(lexer_t *lexer, tokenStream_t *stream, int limit, bool reportErrors) { // Stops once stream has limit tokens
+    assert(lexer);
+    assert(stream);
+
+    const char *begin = lexer->begin;
+    const char *raw = lexer->raw;
+    const char *end = lexer->end;
+    idTable_t *identifiers = lexer->identifiers;
+    int count = stream->count;
+
+    const lexerTables_t *tables = &lexerTables;
+    static const scanner_t scanner = getScanner();
+
+    LEX_STATUS status = LEX_DONE;
+    while (raw < end) {
+        if (stream->count >= limit) {
+            status = LEX_PAUSED;
+            break;
+        }
+
+        unsigned char cls = tables->charClass[(unsigned char) *raw];
+        uint32_t offset = raw - begin;
+
+        if (cls == CLASS_SPACE) {
+            raw = scanner.skipSpaces(raw);
+        } else if (cls >= CLASS_UPPER) { // Keyword, number or identifier
+            const char *start = raw;
+            raw = scanner.skipWord(raw);
+
+            int len = raw - start;
+            unsigned hash = getWordHash(start, len);
+            int num = getKeywordNum(start, len, hash);
+            bool success = false;
+            bool overflow = false;
+            bool added = false;
+            if (num != -1) {
+                added = pushToken(stream, KEYWORD, num, offset);
+            } else if (cls == CLASS_UPPER && (num = parseNumber(start, len, &success, &overflow), success)) {
+                added = pushNumberToken(stream, num, offset);
+            } else if (overflow) {
+                if (reportErrors)
+                    printf("Number %.*s is too large\n", len, start);
+                status = LEX_FAILED;
+                break;
+            } else {
+                added = addIdentifierToken(stream, identifiers, start, len, hash, offset);
+            }
+
+            if (!added) {
+                if (reportErrors)
+                    printf("Not enough memory for tokens\n");
+                status = LEX_FAILED;
+                break;
+            }
+        } else if (cls == CLASS_SYMBOL) {
+            if (!pushToken(stream, SPECIAL_SYMBOL, tables->symbolId[(unsigned char) *raw], offset)) {
+                if (reportErrors)
+                    printf("Not enough memory for tokens\n");
+                status = LEX_FAILED;
+                break;
+            }
+            raw++;
+        } else {
+            if (reportErrors && isprint((unsigned char) *raw))
+                printf("Unexpected character '%c' in input\n", *raw);
+            else if (reportErrors)
+                printf("Unexpected byte 0x%02x in input\n", (unsigned char) *raw);
+            status = LEX_FAILED;
+            break;
+        }
+    }
+
+    lexer->raw = raw;
+    lexer->tokensNum += stream->count - count;
+
+    return status;
+}
+
+bool tokenizeSerial(const char *raw, size_t size, idTable_t *identifiers, tokenStream_t *stream) {
+    assert(raw);
+    assert(identifiers);
+    assert(stream);
+
+    if (!initTokenStream(stream, raw, estimateTokens(size))) {
+        printf("Not enough memory for tokens\n");
+        freeTokenStream(stream);
+        return false;
+    }
+
+    lexer_t lexer = makeLexer(raw, raw, raw + size, identifiers);
+    if (lexRange(&lexer, stream, INT_MAX, true) == LEX_FAILED) {
+        freeTokenStream(stream);
+        return false;
+    }
+
+    if (!finishTokenStream(stream, size)) { // Parser relies on END token behind the last one
+        printf("Not enough memory for tokens\n");
+        freeTokenStream(stream);
+        return false;
+    }
+
+    return true;
+}
+
+const int TOKEN_WINDOW = 1 << 12; // Tokens kept in memory at once in streaming mode
+
+const size_t MIN_LEX_CHUNK = 1 << 20;
+const int LEX_CHUNKS_PER_THREAD = 4;
+
+struct lexChunk_t {
+    const char *start;
+    const char *end;
+    tokenStream_t tokens;
+    idTable_t identifiers; // Chunk-local ids, renumbered while merging
+    LEX_STATUS status;
+};
+
+const char *findLexBoundary(const char *raw, const char *end) { // A token never spans the returned position
+    assert(raw);
+    assert(end);
+
+    const lexerTables_t *tables = &lexerTables;
+    while (raw < end) {
+        char c = *raw++;
+        if (c == ';' || tables->charClass[(unsigned char) c] == CLASS_SPACE)
+            return raw;
+    }
+
+    return end;
+}
+
+bool mergeLexChunks(lexChunk_t *chunks, int chunksNum, size_t size, idTable_t *identifiers, tokenStream_t *stream) {
+    assert(chunks);
+    assert(identifiers);
+    assert(stream);
+
+    int tokensNum = 0;
+    int numbersNum = 0;
+    int maxIds = 0;
+    for (int i = 0; i < chunksNum; i++) {
+        tokensNum += chunks[i].tokens.count;
+        numbersNum += chunks[i].tokens.numbersCount;
+        if (chunks[i].identifiers.count > maxIds)
+            maxIds = chunks[i].identifiers.count;
+    }
+
+    stream->source = chunks[0].start;
+    stream->capacity = tokensNum + 1;
+    stream->words = (uint32_t *) malloc(sizeof(uint32_t) * stream->capacity);
+    stream->offsets = (uint32_t *) malloc(sizeof(uint32_t) * stream->capacity);
+    stream->numbersCapacity = numbersNum;
+    stream->numbers = (int *) malloc(sizeof(int) * (numbersNum + 1));
+    auto globalIds = (uint32_t *) malloc(sizeof(uint32_t) * (maxIds + 1));
+    if (!stream->words || !stream->offsets || !stream->numbers || !globalIds) {
+        free(globalIds);
+        return false;
+    }
+
+    for (int i = 0; i < chunksNum; i++) {
+        const tokenStream_t *tokens = &chunks[i].tokens;
+        const idTable_t *local = &chunks[i].identifiers;
+
+        // Chunks are merged in source order and local ids are dense in order of first use,
+        // so interning them one by one gives the same ids as the serial lexer
+        for (int id = 0; id < local->count; id++) {
+            int global = internIdentifier(identifiers, local->names[id], local->lengths[id], local->hashes[id]);
+            if (global == -1) {
+                free(globalIds);
+                return false;
+            }
+            globalIds[id] = global;
+        }
+
+        for (int j = 0; j < tokens->count; j++) {
+            uint32_t word = tokens->words[j];
+            TOKEN_TYPE type = unpackTokenType(word);
+            if (type == IDENTIFIER)
+                word = packToken(IDENTIFIER, globalIds[unpackTokenId(word)]);
+            else if (type == NUMBER)
+                word = packToken(NUMBER, unpackTokenId(word) + stream->numbersCount);
+
+            stream->words[stream->count] = word;
+            stream->offsets[stream->count] = tokens->offsets[j];
+            stream->count++;
+        }
+
+        memcpy(stream->numbers + stream->numbersCount, tokens->numbers, sizeof(int) * tokens->numbersCount);
+        stream->numbersCount += tokens->numbersCount;
+    }
+
+    free(globalIds);
+
+    stream->words[stream->count] = packToken(END, 0);
+    stream->offsets[stream->count] = size;
+
+    return true;
+}
+
+bool tokenizeParallel(const char *raw, size_t size, idTable_t *identifiers, tokenStream_t *stream, int threadsNum) {
+    assert(raw);
+    assert(identifiers);
+    assert(stream);
+
+    *stream = {};
+
+    int chunksNum = threadsNum * LEX_CHUNKS_PER_THREAD;
+    if (size / chunksNum < MIN_LEX_CHUNK)
+        chunksNum = size / MIN_LEX_CHUNK + 1;
+
+    auto chunks = (lexChunk_t *) calloc(chunksNum, sizeof(lexChunk_t));
+    if (!chunks)
+        return tokenizeSerial(raw, size, identifiers, stream);
+
+    const char *end = raw + size;
+    const char *start = raw;
+    int used = 0;
+    for (int i = 0; i < chunksNum && start < end; i++) {
+        const char *chunkEnd = i == chunksNum - 1 ? end : findLexBoundary(raw + size / chunksNum * (i + 1), end);
+        if (chunkEnd <= start)
+            continue;
+
+        chunks[used].start = start;
+        chunks[used].end = chunkEnd;
+        used++;
+
+        start = chunkEnd;
+    }
+
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        int i = 0;
+        while ((i = next.fetch_add(1)) < used) {
+            lexChunk_t *chunk = chunks + i;
+            chunk->status = LEX_FAILED;
+            if (!initIdTable(&chunk->identifiers) ||
+                !initTokenStream(&chunk->tokens, raw, estimateTokens(chunk->end - chunk->start)))
+                continue;
+
+            lexer_t lexer = makeLexer(raw, chunk->start, chunk->end, &chunk->identifiers);
+            chunk->status = lexRange(&lexer, &chunk->tokens, INT_MAX, false);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadsNum && i < used; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    bool lexed = used > 0;
+    for (int i = 0; i < used; i++)
+        lexed = lexed && chunks[i].status == LEX_DONE;
+
+    bool merged = lexed && mergeLexChunks(chunks, used, size, identifiers, stream);
+
+    for (int i = 0; i < used; i++) {
+        freeTokenStream(&chunks[i].tokens);
+        freeIdTable(&chunks[i].identifiers);
+    }
+    free(chunks);
+
+    if (merged)
+        return true;
+
+    // Errors or lack of memory: let the serial lexer stop and report exactly where it would
+    freeTokenStream(stream);
+    freeIdTable(identifiers);
+    if (!initIdTable(identifiers)) {
+        printf("Not enough memory for identifiers\n");
+        return false;
+    }
+
+    return tokenizeSerial(raw, size, identifiers, stream);
+}
+
+bool tokenize(const char *raw, size_t size, idTable_t *identifiers, tokenStream_t *stream, int threadsNum) {
+    assert(raw);
+    assert(identifiers);
+    assert(stream);
+
+    assert(size <= UINT32_MAX);
+
+    if (threadsNum > 1 && size >= 2 * MIN_LEX_CHUNK)
+        return tokenizeParallel(raw, size, identifiers, stream, threadsNum);
+
+    return tokenizeSerial(raw, size, identifiers, stream);
+}
+
+void finishTokenWindow(tokenCursor_t *cursor, uint32_t offset, bool failed) { // No more refills, END goes last
+    assert(cursor);
+
+    tokenStream_t *stream = cursor->stream;
+
+    cursor->refill = nullptr;
+    cursor->failed = failed; // Error is already printed, the parser only sees a premature END
+
+    if (!finishTokenStream(stream, offset)) {
+        printf("Not enough memory for tokens\n");
+        cursor->failed = true;
+
+        // Window is full, so sacrifice the current token for the END
+        stream->count = cursor->pos;
+        stream->words[stream->count] = packToken(END, 0);
+    }
+}
+
+void refillTokens(tokenCursor_t *cursor) { // Streaming mode: lexes the next window of tokens on demand
+    assert(cursor);
+    assert(cursor->lexer);
+
+    auto lexer = (lexer_t *) cursor->lexer;
+    tokenStream_t *stream = cursor->stream;
+
+    dropConsumedTokens(cursor);
+
+    LEX_STATUS status = lexRange(lexer, stream, TOKEN_WINDOW, true);
+    if (status == LEX_PAUSED)
+        return;
+
+    finishTokenWindow(cursor, lexer->end - lexer->begin, status == LEX_FAILED);
+}
+
+bool openTokenStream(const char *raw, size_t size, idTable_t *identifiers, tokenStream_t *stream, lexer_t *lexer,
+                     tokenCursor_t *cursor) { // Streaming counterpart of tokenize, tokens are lexed while parsing
+    assert(raw);
+    assert(identifiers);
+    assert(stream);
+    assert(lexer);
+    assert(cursor);
+
+    assert(size <= UINT32_MAX);
+
+    if (!initTokenStream(stream, raw, TOKEN_WINDOW)) {
+        printf("Not enough memory for tokens\n");
+        freeTokenStream(stream);
+        return false;
+    }
+
+    *lexer = makeLexer(raw, raw, raw + size, identifiers);
+    *cursor = makeTokenCursor(stream, refillTokens, lexer);
+
+    return true;
+}
+
+void lexIntoRing(tokenPipeline_t *pipeline) { // Producer side, runs on the lexer thread
+    assert(pipeline);
+
+    tokenRing_t *ring = &pipeline->ring;
+    unsigned head = 0;
+
+    while (true) {
+        while (head - ring->tail.load(std::memory_order_acquire) == TOKEN_RING_SLOTS) {
+            if (pipeline->stop.load(std::memory_order_relaxed))
+                return;
+            std::this_thread::yield();
+        }
+
+        tokenStream_t *chunk = &ring->slots[head % TOKEN_RING_SLOTS].tokens;
+        chunk->count = 0;
+        chunk->numbersCount = 0;
+
+        LEX_STATUS status = lexRange(&pipeline->lexer, chunk, TOKEN_WINDOW, true);
+        ring->slots[head % TOKEN_RING_SLOTS].status = status;
+
+        head++;
+        ring->head.store(head, std::memory_order_release);
+
+        if (status != LEX_PAUSED)
+            return;
+    }
+}
+
+void refillFromRing(tokenCursor_t *cursor) { // Consumer side, runs on the parser thread
+    assert(cursor);
+    assert(cursor->lexer);
+
+    auto pipeline = (tokenPipeline_t *) cursor->lexer;
+    tokenRing_t *ring = &pipeline->ring;
+    tokenStream_t *stream = cursor->stream;
+
+    dropConsumedTokens(cursor);
+
+    while (cursor->refill && cursor->pos + TOKEN_LOOKAHEAD >= stream->count) { // Chunks may be empty
+        unsigned tail = ring->tail.load(std::memory_order_relaxed);
+        while (ring->head.load(std::memory_order_acquire) == tail)
+            std::this_thread::yield();
+
+        tokenChunk_t *chunk = ring->slots + tail % TOKEN_RING_SLOTS;
+        bool copied = appendTokens(stream, &chunk->tokens);
+        LEX_STATUS status = chunk->status;
+
+        ring->tail.store(tail + 1, std::memory_order_release);
+
+        if (!copied) {
+            printf("Not enough memory for tokens\n");
+            finishTokenWindow(cursor, 0, true);
+        } else if (status != LEX_PAUSED) {
+            finishTokenWindow(cursor, pipeline->lexer.end - pipeline->lexer.begin, status == LEX_FAILED);
+        }
+    }
+}
+
+bool openTokenPipeline(const char *raw, size_t size, idTable_t *identifiers, tokenStream_t *stream,
+                       tokenPipeline_t *pipeline, tokenCursor_t *cursor) { // Lexes on a separate thread while parsing
+    assert(raw);
+    assert(identifiers);
+    assert(stream);
+    assert(pipeline);
+    assert(cursor);
+
+    assert(size <= UINT32_MAX);
+
+    bool allocated = initTokenStream(stream, raw, 2 * TOKEN_WINDOW);
+    for (int i = 0; i < TOKEN_RING_SLOTS; i++)
+        allocated = initTokenStream(&pipeline->ring.slots[i].tokens, raw, TOKEN_WINDOW) && allocated;
+
+    if (!allocated) {
+        printf("Not enough memory for tokens\n");
+        freeTokenStream(stream);
+        for (int i = 0; i < TOKEN_RING_SLOTS; i++)
+            freeTokenStream(&pipeline->ring.slots[i].tokens);
+        return false;
+    }
+
+    pipeline->lexer = makeLexer(raw, raw, raw + size, identifiers);
+    pipeline->thread = std::thread(lexIntoRing, pipeline);
+    *cursor = makeTokenCursor(stream, refillFromRing, pipeline);
+
+    return true;
+}
+
+void closeTokenPipeline(tokenPipeline_t *pipeline) { // Lexer thread may still be running if parsing failed early
+    assert(pipeline);
+
+    if (!pipeline->thread.joinable())
+        return;
+
+    pipeline->stop.store(true, std::memory_order_relaxed);
+    pipeline->thread.join();
+
+    for (int i = 0; i < TOKEN_RING_SLOTS; i++)
+        freeTokenStream(&pipeline->ring.slots[i].tokens);
+}
+
+bool readSource(int fd, source_t *source) { // Buffered fallback for pipes, terminals and other unmappable inputs
+    assert(source);
+
+    size_t capacity = 1 << 16;
+    size_t size = 0;
+    auto content = (char *) malloc(capacity);
+    if (!content)
+        return false;
+
+    while (true) {
+        if (capacity - size <= SOURCE_PADDING) {
+            capacity *= 2;
+            auto grown = (char *) realloc(content, capacity);
+            if (!grown) {
+                free(content);
+                return false;
+            }
+            content = grown;
+        }
+
+        ssize_t got = read(fd, content + size, capacity - size - SOURCE_PADDING);
+        if (got == 0)
+            break;
+        if (got < 0) {
+            free(content);
+            return false;
+        }
+        size += got;
+    }
+
+    memset(content + size, '\0', SOURCE_PADDING);
+
+    source->data = content;
+    source->size = size;
+    source->mappedSize = 0;
+
+    return true;
+}
+
+bool mapSource(int fd, size_t size, source_t *source) { // Zero-copy read-only mapping with a zero page behind the file
+    assert(source);
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t fileSpan = (size + page - 1) / page * page;
+    size_t mappedSize = fileSpan + page;
+
+    // Reserve one extra anonymous page so the padding is readable zeros even when size is a multiple of page size
+    void *region = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return false;
+
+    if (size && mmap(region, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(region, mappedSize);
+        return false;
+    }
+
+    madvise(region, size, MADV_SEQUENTIAL);
+
+    source->data = (char *) region;
+    source->size = size;
+    source->mappedSize = mappedSize;
+
+    return true;
+}
+
+bool loadSource(const char *filename, source_t *source) {
+    assert(filename);
+    assert(source);
+
+    bool fromStdin = strcmp(filename, "-") == 0;
+    int fd = fromStdin ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info = {};
+    bool loaded = false;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+        loaded = mapSource(fd, info.st_size, source);
+
+    if (!loaded)
+        loaded = readSource(fd, source);
+
+    if (!fromStdin)
+        close(fd);
+
+    return loaded;
+}
+
+void freeSource(source_t *source) {
+    assert(source);
+
+    if (source->mappedSize)
+        munmap(source->data, source->mappedSize);
+    else
+        free(source->data);
+
+    *source = {};
+}
+
+bool isLexable(const source_t *source) { // Token offsets are 32-bit, so every lexing entry point relies on this
+    assert(source);
+
+    if (source->size > UINT32_MAX) {
+        printf("Input is too large\n");
+        return false;
+    }
+
+    return true;
+}
+
+node_t *getVarlist(tokenCursor_t *tokens) {
+    assert(tokens);
+
+    value_t *headVal = makeValue(VARLIST, 0);
+    node_t *head = makeNode(nullptr, nullptr, nullptr, headVal);
+
+    node_t *current = head;
+
+    while (tokenType(tokens) == IDENTIFIER) {
+        value_t *idVal = makeValue(ID, tokenId(tokens));
+        value_t *varlistVal = makeValue(VARLIST, 0);
+
+        node_t *idNode = makeNode(nullptr, nullptr, nullptr, idVal);
+        node_t *varlistNode = makeNode(current, nullptr, idNode, varlistVal);
+        current->left = varlistNode;
+
+        current = varlistNode;
+
+        advanceToken(tokens);
+
+        if (isSymbol(tokens, comma))
+            advanceToken(tokens);
+    }
+
+    if(head->left) {
+        head = head->left;
+        head->parent = nullptr;
+    }
+
+    return head;
+}
+
+node_t *getId(tokenCursor_t *tokens) {
+    assert(tokens);
+
+    if (tokenType(tokens) == IDENTIFIER) {
+        value_t *val = makeValue(ID, tokenId(tokens));
+        node_t *node = makeNode(nullptr, nullptr, nullptr, val);
+        advanceToken(tokens);
+
+        return node;
+    }
+
+    return nullptr;
+}
+
+node_t *getOperand(tokenCursor_t *tokens) { // Variable, number or function call
+    assert(tokens);
+
+    if (tokenType(tokens) == IDENTIFIER) {
+        if (isSymbol(tokens, left, 1)) {
             node_t *call = getCall(tokens);
             return call;
         } else {
             node_t *idNode = getId(tokens);
             return idNode;
         }
-    } else if ((*tokens)->type == NUMBER) {
-        value_t *numVal = makeValue(NUM, (*tokens)->id);
+    } else if (tokenType(tokens) == NUMBER) {
+        value_t *numVal = makeValue(NUM, tokenId(tokens));
         node_t *numNode = makeNode(nullptr, nullptr, nullptr, numVal);
 
-        (*tokens)++;
+        advanceToken(tokens);
+
+        return numNode;
+    }
+
+    return nullptr;
+}
+
+int getBindingPower(const tokenCursor_t *tokens) { // 0 if current token is not a binary operator
+    if (tokenType(tokens) != KEYWORD)
+        return 0;
+
+    return bindingPowers.power[tokenId(tokens)];
+}
+
+struct exprOperator_t {
+    int id; // Keyword, -1 for a plain parenthesis
+    int power; // 0 for an open parenthesis or sqrt
+};
+
+void reduceOperator(std::vector<node_t *> *operands, std::vector<exprOperator_t> *operators) {
+    assert(operands);
+    assert(operators);
+    assert(operands->size() >= 2);
 
-        return numNode;
-    }
+    node_t *subtree2 = operands->back();
+    operands->pop_back();
+
+    value_t *arithm = makeValue(ARITHM_OP, operators->back().id);
+    operators->pop_back();
+
+    operands->back() = makeNode(nullptr, operands->back(), subtree2, arithm);
 }
 
-node_t *getM(token_t **tokens) { // Parse multiplication and division i. e. high priority operators
+node_t *getE(tokenCursor_t *tokens) { // Operator precedence parsing on explicit stacks, so nesting depth costs no recursion
     assert(tokens);
 
-    node_t *subtree = getParenthesis(tokens);
-    if (!subtree)
-        return nullptr;
+    // Not reentrant, arguments of a call are plain identifiers; memory of the stacks is kept for the next call
+    thread_local std::vector<node_t *> operands;
+    thread_local std::vector<exprOperator_t> operators;
+    operands.clear();
+    operators.clear();
+    int opened = 0;
+
+    while (true) {
+        if (isSymbol(tokens, left)) {
+            advanceToken(tokens);
+            operators.push_back({-1, 0});
+            opened++;
+            continue;
+        }
 
-    while ((*tokens)->type == KEYWORD && ((*tokens)->id == mix || (*tokens)->id == steal)) {
-        value_t *arithm = makeValue(ARITHM_OP, (*tokens)->id);
-        (*tokens)++;
-        node_t *subtree2 = getParenthesis(tokens);
-        node_t *suptree = makeNode(nullptr, subtree, subtree2, arithm);
-        subtree = suptree;
-    }
+        if (isKeyword(tokens, sqrt)) {
+            advanceToken(tokens);
+            if (!isSymbol(tokens, left))
+                return nullptr;
+            advanceToken(tokens);
 
-    return subtree;
-}
+            operators.push_back({sqrt, 0});
+            opened++;
+            continue;
+        }
 
-node_t *getT(token_t **tokens) { // Parse addition and subtraction i. e. middle priority operators
-    assert(tokens);
+        node_t *operand = getOperand(tokens);
+        if (!operand)
+            return nullptr;
+        operands.push_back(operand);
 
-    node_t *subtree = getM(tokens);
-    if (!subtree)
-        return nullptr;
+        // Close parentheses following the operand until an operator or the end of the expression
+        while (opened && isSymbol(tokens, right)) {
+            while (operators.back().power)
+                reduceOperator(&operands, &operators);
 
-    while ((*tokens)->type == KEYWORD && ((*tokens)->id == add || (*tokens)->id == filter)) {
-        value_t *arithm = makeValue(ARITHM_OP, (*tokens)->id);
-        (*tokens)++;
-        node_t *subtree2 = getM(tokens);
-        node_t *suptree = makeNode(nullptr, subtree, subtree2, arithm);
-        subtree = suptree;
-    }
+            if (operators.back().id == sqrt) {
+                value_t *sqrtVal = makeValue(ARITHM_OP, sqrt);
+                operands.back() = makeNode(nullptr, nullptr, operands.back(), sqrtVal);
+            }
+            operators.pop_back();
+            opened--;
 
-    return subtree;
-}
+            advanceToken(tokens);
+        }
 
-node_t *getE(token_t **tokens) { // Parse logical operators i. e. lowe priority
-    assert(tokens);
+        int power = getBindingPower(tokens);
+        if (!power)
+            break;
 
-    node_t *subtree = getT(tokens);
-    if (!subtree)
-        return nullptr;
+        // Operators are left associative, so everything binding at least as tight is complete
+        while (!operators.empty() && operators.back().power >= power)
+            reduceOperator(&operands, &operators);
 
-    while ((*tokens)->type == KEYWORD &&
-           ((*tokens)->id == sourer || (*tokens)->id == bitterer || (*tokens)->id == justlike)) {
-        value_t *arithm = makeValue(ARITHM_OP, (*tokens)->id);
-        (*tokens)++;
-        node_t *subtree2 = getT(tokens);
-        node_t *suptree = makeNode(nullptr, subtree, subtree2, arithm);
-        subtree = suptree;
+        operators.push_back({tokenId(tokens), power});
+        advanceToken(tokens);
     }
 
-    return subtree;
+    if (opened)
+        return nullptr;
+
+    while (!operators.empty())
+        reduceOperator(&operands, &operators);
+
+    return operands.back();
 }
 
-node_t *getCall(token_t **tokens) {
+node_t *getCall(tokenCursor_t *tokens) {
     assert(tokens);
 
     node_t *id = getId(tokens);
@@ -754,17 +1974,17 @@ node_t *getCall(token_t **tokens) {
     if (!id)
         return nullptr;
 
-    if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != left)
+    if (!isSymbol(tokens, left))
         return nullptr;
 
-    (*tokens)++;
+    advanceToken(tokens);
 
     node_t *varlist = getVarlist(tokens);
 
-    if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != right)
+    if (!isSymbol(tokens, right))
         return nullptr;
 
-    (*tokens)++;
+    advanceToken(tokens);
 
     value_t *callVal = makeValue(CALL, 0);
     node_t *callNode = makeNode(nullptr, id, varlist, callVal);
@@ -772,12 +1992,12 @@ node_t *getCall(token_t **tokens) {
     return callNode;
 }
 
-node_t *getOp(token_t **tokens) {
+node_t *getOp(tokenCursor_t *tokens) {
     assert(tokens);
 
-    if ((*tokens)->type == KEYWORD) {
-        if ((*tokens)->id == testtube) {
-            (*tokens)++;
+    if (tokenType(tokens) == KEYWORD) {
+        if (tokenId(tokens) == testtube) {
+            advanceToken(tokens);
 
             node_t *id = getId(tokens);
 
@@ -787,8 +2007,8 @@ node_t *getOp(token_t **tokens) {
             value_t *val = makeValue(VAR, 0);
             node_t *exp = nullptr;
 
-            if ((*tokens)->type == KEYWORD && (*tokens)->id == is) {
-                (*tokens)++;
+            if (isKeyword(tokens, is)) {
+                advanceToken(tokens);
                 exp = getE(tokens);
                 if (!exp)
                     return nullptr;
@@ -797,147 +2017,88 @@ node_t *getOp(token_t **tokens) {
 
             node_t *varNode = makeNode(nullptr, exp, id, val);
 
-            if (((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != semicolon))
+            if (!isSymbol(tokens, semicolon))
                 return nullptr;
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             return varNode;
         }
-        else if ((*tokens)->id == taste) {
-            (*tokens)++;
-
-            if (((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != left))
-                return nullptr;
-            (*tokens)++;
-
-            node_t *cond = getE(tokens);
-            if (!cond)
-                return nullptr;
-
-            if (((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != right))
-                return nullptr;
-            (*tokens)++;
-
-            node_t *ifTrue = getB(tokens);
-            if (!ifTrue)
-                return nullptr;
-
-            node_t *ifFalse = nullptr;
-
-            if ((*tokens)->type == KEYWORD && (*tokens)->id == emergencyroom) {
-                (*tokens)++;
-                ifFalse = getB(tokens);
-                if (!ifFalse)
-                    return nullptr;
-            }
-
-            value_t *altBranchesVal = makeValue(C, 0);
-            node_t *altBranches = makeNode(nullptr, ifFalse, ifTrue, altBranchesVal);
-
-            value_t *ifVal = makeValue(IF, 0);
-            node_t *ifNode = makeNode(nullptr, cond, altBranches, ifVal);
-
-            return ifNode;
-
-        } else if ((*tokens)->id == eat) {
-            (*tokens)++;
-
-            if (((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != left))
-                return nullptr;
-            (*tokens)++;
-
-            node_t *cond = getE(tokens);
-            if (!cond)
-                return nullptr;
-
-            if (((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != right))
-                return nullptr;
-            (*tokens)++;
-
-            node_t *repeated = getB(tokens);
-            if (!repeated)
-                return nullptr;
-
-            value_t *cycleVal = makeValue(WHILE, 0);
-            node_t *whileNode = makeNode(nullptr, cond, repeated, cycleVal);
-
-            return whileNode;
-        } else if ((*tokens)->id == synthesize) {
-            (*tokens)++;
+        else if (tokenId(tokens) == synthesize) {
+            advanceToken(tokens);
 
             node_t *exp = getE(tokens);
 
-            if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != semicolon)
+            if (!isSymbol(tokens, semicolon))
                 return nullptr;
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             value_t *synthVal = makeValue(RETURN, 0);
             node_t *returnNode = makeNode(nullptr, nullptr, exp, synthVal);
 
             return returnNode;
-        } else if ((*tokens)->id == report) {
-            (*tokens)++;
+        } else if (tokenId(tokens) == report) {
+            advanceToken(tokens);
 
             node_t *id = getId(tokens);
             value_t *outputValue = makeValue(OUTPUT, 0);
 
             node_t *outputNode = makeNode(nullptr, nullptr, id, outputValue);
 
-            if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != semicolon)
+            if (!isSymbol(tokens, semicolon))
                 return nullptr;
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             return outputNode;
 
-        } else if ((*tokens)->id == getorder) {
-            (*tokens)++;
+        } else if (tokenId(tokens) == getorder) {
+            advanceToken(tokens);
 
             node_t *id = getId(tokens);
             value_t *inputValue = makeValue(INPUT, 0);
 
             node_t *inputNode = makeNode(nullptr, nullptr, id, inputValue);
 
-            if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != semicolon)
+            if (!isSymbol(tokens, semicolon))
                 return nullptr;
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             return inputNode;
-        } else if ((*tokens)->id == explode) {
-            (*tokens)++;
+        } else if (tokenId(tokens) == explode) {
+            advanceToken(tokens);
 
             value_t *explodeValue = makeValue(EXPLODE, 0);
             node_t *explodeNode = makeNode(nullptr, nullptr, nullptr, explodeValue);
 
-            if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != semicolon)
+            if (!isSymbol(tokens, semicolon))
                 return nullptr;
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             return explodeNode;
-        } else if ((*tokens)->id == ramexplode) {
-            (*tokens)++;
+        } else if (tokenId(tokens) == ramexplode) {
+            advanceToken(tokens);
 
             value_t *explodeValue = makeValue(RAMEXPLODE, 0);
             node_t *explodeNode = makeNode(nullptr, nullptr, nullptr, explodeValue);
 
-            if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != semicolon)
+            if (!isSymbol(tokens, semicolon))
                 return nullptr;
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             return explodeNode;
         }else {
             return nullptr;
         }
-    } else if ((*tokens)->type == IDENTIFIER) {
+    } else if (tokenType(tokens) == IDENTIFIER) {
         node_t *id = getId(tokens);
-        if ((*tokens)->type == KEYWORD && (*tokens)->id == is) {
+        if (isKeyword(tokens, is)) {
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             node_t *val = getE(tokens);
 
@@ -947,22 +2108,22 @@ node_t *getOp(token_t **tokens) {
             value_t *assVal = makeValue(ASSIGN, 0);
             node_t *assignNode = makeNode(nullptr, id, val, assVal);
 
-            if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != semicolon)
+            if (!isSymbol(tokens, semicolon))
                 return nullptr;
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             return assignNode;
-        } else if ((*tokens)->type == SPECIAL_SYMBOL && (*tokens)->id == left) {
-            (*tokens)++;
+        } else if (isSymbol(tokens, left)) {
+            advanceToken(tokens);
             node_t *arg = getVarlist(tokens);
             value_t *callVal = makeValue(CALL, 0);
             node_t *callNode = makeNode(nullptr, id, arg, callVal);
 
-            if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != semicolon)
+            if (!isSymbol(tokens, semicolon))
                 return nullptr;
 
-            (*tokens)++;
+            advanceToken(tokens);
 
             return callNode;
         } else {
@@ -973,77 +2134,252 @@ node_t *getOp(token_t **tokens) {
     }
 }
 
-node_t *getB(token_t **tokens) {
+enum BLOCK_FRAME {
+    FRAME_BLOCK, // Statements of a block
+    FRAME_IF_TRUE, // taste waiting for its block
+    FRAME_IF_FALSE, // taste waiting for its emergencyroom block
+    FRAME_WHILE // eat waiting for its block
+};
+
+struct blockFrame_t {
+    BLOCK_FRAME type;
+    node_t *top; // First OP of the block, or condition of a branching; nullptr if the condition was broken
+    node_t *current; // Last OP of the block, or the taste block of a branching
+};
+
+bool openBlock(tokenCursor_t *tokens, std::vector<blockFrame_t> *frames) {
+    assert(tokens);
+    assert(frames);
+
+    if (!isKeyword(tokens, labprotocol))
+        return false;
+    advanceToken(tokens);
+
+    frames->push_back({FRAME_BLOCK, nullptr, nullptr});
+
+    return true;
+}
+
+node_t *getCondition(tokenCursor_t *tokens) { // ( E ) of taste and eat
     assert(tokens);
-    if ((*tokens)->type != KEYWORD || (*tokens)->id != labprotocol)
+
+    if (!isSymbol(tokens, left))
         return nullptr;
+    advanceToken(tokens);
 
-    (*tokens)++;
+    node_t *cond = getE(tokens);
+    if (!cond)
+        return nullptr;
 
-    value_t *bVal = makeValue(B, 0);
+    if (!isSymbol(tokens, right))
+        return nullptr;
+    advanceToken(tokens);
 
-    node_t *top = nullptr;
-    node_t *current = nullptr;
+    return cond;
+}
 
-    if ((*tokens)->type != KEYWORD || (*tokens)->id != endprotocol) {
-        value_t *topVal = makeValue(OP, 0);
-        node_t *op = getOp(tokens);
-        if (!op)
-            return nullptr;
+void appendOp(blockFrame_t *frame, node_t *op) {
+    assert(frame);
+    assert(op);
 
-        top = makeNode(nullptr, nullptr, op, topVal);
-        current = top;
+    value_t *val = makeValue(OP, 0);
+    node_t *node = makeNode(frame->current, nullptr, op, val);
 
-        while (*tokens) {
-            if ((*tokens)->type == KEYWORD && (*tokens)->id == endprotocol)
-                break;
+    if (frame->current)
+        frame->current->left = node;
+    else
+        frame->top = node;
+    frame->current = node;
+}
 
-            op = getOp(tokens);
-            if (!op)
-                return nullptr;
+void addSyntaxError(const tokenCursor_t *tokens) { // Nothing is allocated until the first error
+    assert(tokens);
+    assert(syntaxErrors);
+
+    uint32_t offset = tokens->stream->offsets[tokens->pos];
+    if (syntaxErrors->empty() || syntaxErrors->back() != offset)
+        syntaxErrors->push_back(offset);
+}
+
+bool skipStatement(tokenCursor_t *tokens) { // Panic mode, false if the definition itself has to be abandoned
+    assert(tokens);
 
-            value_t *val = makeValue(OP, 0);
-            node_t *node = makeNode(current, nullptr, op, val);
-            current->left = node;
-            current = node;
+    // Stops after ';' or a whole block (with its emergencyroom block), or before the endprotocol of the current block
+    int depth = 0;
+    while (tokenType(tokens) != END && !isKeyword(tokens, labassistant)) {
+        if (depth == 0 && isSymbol(tokens, semicolon)) {
+            advanceToken(tokens);
+            return true;
         }
+
+        if (isKeyword(tokens, endprotocol)) {
+            if (depth == 0)
+                return true;
+
+            advanceToken(tokens);
+            if (--depth == 0 && !isKeyword(tokens, emergencyroom))
+                return true;
+            continue;
+        }
+
+        if (isKeyword(tokens, labprotocol))
+            depth++;
+        advanceToken(tokens);
+    }
+
+    return false;
+}
+
+bool skipToBlock(tokenCursor_t *tokens) { // After a broken taste or eat header, false if the definition has to be abandoned
+    assert(tokens);
+
+    // Stops before the block of the header or the endprotocol of the current block, or after ';' if no block follows
+    while (tokenType(tokens) != END && !isKeyword(tokens, labassistant)) {
+        if (isKeyword(tokens, labprotocol) || isKeyword(tokens, endprotocol))
+            return true;
+
+        bool statementEnd = isSymbol(tokens, semicolon);
+        advanceToken(tokens);
+        if (statementEnd)
+            return true;
     }
 
-    if (!(*tokens))
+    return false;
+}
+
+node_t *getB(tokenCursor_t *tokens) { // Nested blocks live on an explicit stack of frames instead of the call stack
+    assert(tokens);
+
+    // Only getD parses blocks, so the frames are never shared by two calls; their memory is kept for the next one
+    thread_local std::vector<blockFrame_t> frames;
+    frames.clear();
+    if (!openBlock(tokens, &frames))
         return nullptr;
 
-    node_t *bNode = makeNode(nullptr, nullptr, top, bVal);
+    while (true) {
+        if (tokenType(tokens) == END) {
+            addSyntaxError(tokens);
+            return nullptr;
+        }
+
+        if (!isKeyword(tokens, endprotocol)) {
+            bool parsed = true;
+
+            if (isKeyword(tokens, taste) || isKeyword(tokens, eat)) {
+                BLOCK_FRAME type = isKeyword(tokens, taste) ? FRAME_IF_TRUE : FRAME_WHILE;
+                advanceToken(tokens);
+
+                // Blocks of a broken header are still parsed for their errors, a frame without condition drops them
+                node_t *cond = getCondition(tokens);
+                if (!cond) {
+                    addSyntaxError(tokens);
+                    if (!skipToBlock(tokens))
+                        return nullptr;
+                    if (!isKeyword(tokens, labprotocol))
+                        continue;
+                }
+
+                frames.push_back({type, cond, nullptr});
+                parsed = openBlock(tokens, &frames);
+                if (!parsed)
+                    frames.pop_back();
+            } else {
+                node_t *op = getOp(tokens);
+                if (op)
+                    appendOp(&frames.back(), op);
+                else
+                    parsed = false;
+            }
+
+            // Broken statement is dropped, parsing goes on after it
+            if (!parsed) {
+                addSyntaxError(tokens);
+                if (!skipStatement(tokens))
+                    return nullptr;
+            }
+
+            continue;
+        }
+
+        advanceToken(tokens);
+
+        value_t *bVal = makeValue(B, 0);
+        node_t *statement = makeNode(nullptr, nullptr, frames.back().top, bVal);
+        frames.pop_back();
+
+        // Finished block completes the statements waiting for it, innermost first
+        while (!frames.empty() && frames.back().type != FRAME_BLOCK) {
+            blockFrame_t *frame = &frames.back();
+
+            if (frame->type == FRAME_IF_TRUE && isKeyword(tokens, emergencyroom)) {
+                advanceToken(tokens);
+
+                frame->type = FRAME_IF_FALSE;
+                frame->current = statement;
+                statement = nullptr;
+                if (!openBlock(tokens, &frames)) {
+                    frames.pop_back();
+                    addSyntaxError(tokens);
+                    if (!skipStatement(tokens))
+                        return nullptr;
+                }
+                break;
+            }
+
+            if (!frame->top) {
+                statement = nullptr;
+            } else if (frame->type == FRAME_WHILE) {
+                value_t *cycleVal = makeValue(WHILE, 0);
+                statement = makeNode(nullptr, frame->top, statement, cycleVal);
+            } else {
+                node_t *ifTrue = frame->type == FRAME_IF_TRUE ? statement : frame->current;
+                node_t *ifFalse = frame->type == FRAME_IF_TRUE ? nullptr : statement;
+
+                value_t *altBranchesVal = makeValue(C, 0);
+                node_t *altBranches = makeNode(nullptr, ifFalse, ifTrue, altBranchesVal);
+
+                value_t *ifVal = makeValue(IF, 0);
+                statement = makeNode(nullptr, frame->top, altBranches, ifVal);
+            }
+
+            frames.pop_back();
+        }
+
+        if (!statement)
+            continue;
 
-    (*tokens)++;
+        if (frames.empty())
+            return statement;
 
-    return bNode;
+        appendOp(&frames.back(), statement);
+    }
 }
 
-node_t *getD(token_t **tokens) {
+node_t *getD(tokenCursor_t *tokens) {
     assert(tokens);
-    if ((*tokens)->type != KEYWORD || (*tokens)->id != labassistant)
+    if (!isKeyword(tokens, labassistant))
         return nullptr;
 
-    (*tokens)++;
+    advanceToken(tokens);
 
     node_t *id = getId(tokens);
     if (!id)
         return nullptr;
 
-    if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != left)
+    if (!isSymbol(tokens, left))
         return nullptr;
 
-    (*tokens)++;
+    advanceToken(tokens);
 
     node_t *varlist = getVarlist(tokens);
 
     if (!varlist)
         return nullptr;
 
-    if ((*tokens)->type != SPECIAL_SYMBOL || (*tokens)->id != right)
+    if (!isSymbol(tokens, right))
         return nullptr;
 
-    (*tokens)++;
+    advanceToken(tokens);
 
     node_t *b = getB(tokens);
 
@@ -1062,25 +2398,527 @@ node_t *getD(token_t **tokens) {
     return node;
 }
 
-tree_t *getP(token_t *tokens) {
+void reportSyntaxErrors(tokenCursor_t *tokens, const std::vector<uint32_t> *errors) {
     assert(tokens);
-    node_t *subtree1 = getD(&tokens);
-    if (!subtree1)
-        return nullptr;
+    assert(errors);
 
-    while (tokens->id != END) {
-        node_t *subtree2 = getD(&tokens);
-        subtree2->left = subtree1;
-        subtree1->parent = subtree2;
+    if (tokens->failed) // Lexer has already explained why the input ended early
+        return;
 
-        subtree1 = subtree2;
+    for (uint32_t offset : *errors) {
+        int line = 0;
+        int column = 0;
+        if (getOffsetPosition(tokens->stream, offset, &line, &column))
+            printf("Syntax error at line %d, column %d\n", line, column);
+        else
+            printf("Syntax error at offset %u\n", offset);
     }
 
+    if (errors->size() > 1)
+        printf("%zu syntax errors\n", errors->size());
+}
+
+tree_t *makeProgramTree(node_t *lastDefinition) { // Definitions are chained from the last one through left
+    assert(lastDefinition);
+
     value_t *val = makeValue(P, 0);
-    node_t *progroot = makeNode(nullptr, nullptr, subtree1, val);
+    node_t *progroot = makeNode(nullptr, nullptr, lastDefinition, val);
 
     tree_t *tree = makeTree(nullptr);
     tree->head = progroot;
 
     return tree;
-}
\ No newline at end of file
+}
+
+tree_t *getP(tokenCursor_t *tokens) { // Goes through the whole program and reports every syntax error in it
+    assert(tokens);
+
+    std::vector<uint32_t> errors;
+    syntaxErrors = &errors;
+
+    node_t *subtree1 = nullptr;
+    do {
+        size_t known = errors.size();
+        node_t *subtree2 = getD(tokens);
+        if (!subtree2) {
+            if (errors.size() == known)
+                addSyntaxError(tokens);
+
+            // Broken definition is dropped up to the next one
+            while (tokenType(tokens) != END && !isKeyword(tokens, labassistant))
+                advanceToken(tokens);
+            continue;
+        }
+
+        if (subtree1) {
+            subtree2->left = subtree1;
+            subtree1->parent = subtree2;
+        }
+
+        subtree1 = subtree2;
+    } while (tokenType(tokens) != END);
+
+    syntaxErrors = nullptr;
+    if (!errors.empty()) {
+        reportSyntaxErrors(tokens, &errors);
+        return nullptr;
+    }
+
+    return makeProgramTree(subtree1);
+}
+
+const int MIN_PARALLEL_PARSE_TOKENS = 1 << 16;
+const int PARSE_GROUPS_PER_THREAD = 4;
+
+bool findDefinitions(const tokenStream_t *stream, std::vector<int> *starts) { // Splits at labassistant outside blocks
+    assert(stream);
+    assert(starts);
+
+    int depth = 0;
+    for (int i = 0; i < stream->count; i++) {
+        uint32_t word = stream->words[i];
+
+        if (word == packToken(KEYWORD, labprotocol)) {
+            depth++;
+        } else if (word == packToken(KEYWORD, endprotocol)) {
+            if (--depth < 0)
+                return false;
+        } else if (depth == 0 && word == packToken(KEYWORD, labassistant)) {
+            starts->push_back(i);
+        }
+    }
+
+    return depth == 0 && !starts->empty() && (*starts)[0] == 0;
+}
+
+tree_t *getPParallel(tokenStream_t *stream, int threadsNum) { // Same tree as getP, definitions are parsed concurrently
+    assert(stream);
+
+    std::vector<int> starts;
+    if (threadsNum < 2 || stream->count < MIN_PARALLEL_PARSE_TOKENS || !findDefinitions(stream, &starts)) {
+        tokenCursor_t cursor = makeTokenCursor(stream);
+        return getP(&cursor);
+    }
+
+    int definitionsNum = starts.size();
+    starts.push_back(stream->count);
+
+    // Consecutive definitions are grouped into runs of similar token count
+    std::vector<int> groups;
+    int groupTokens = stream->count / (threadsNum * PARSE_GROUPS_PER_THREAD) + 1;
+    for (int i = 0; i < definitionsNum; i++)
+        if (groups.empty() || starts[i] - starts[groups.back()] >= groupTokens)
+            groups.push_back(i);
+    groups.push_back(definitionsNum);
+
+    int groupsNum = groups.size() - 1;
+    std::vector<node_t *> definitions(definitionsNum);
+    std::vector<arena_t> arenas(threadsNum);
+    std::vector<nodePool_t> pools(threadsNum);
+    std::atomic<int> next(0);
+    std::atomic<bool> failed(false);
+
+    auto worker = [&](int thread) {
+        if (thread)
+            astArena = &arenas[thread]; // First worker runs on this thread and keeps its arena
+
+        std::vector<uint32_t> errors; // Recovered errors fail the definition as well
+        syntaxErrors = &errors;
+
+        int group = 0;
+        while ((group = next.fetch_add(1)) < groupsNum && !failed.load(std::memory_order_relaxed)) {
+            tokenCursor_t cursor = makeTokenCursor(stream);
+
+            for (int i = groups[group]; i < groups[group + 1]; i++) {
+                seekToken(&cursor, starts[i]);
+                definitions[i] = getD(&cursor);
+
+                // Definition has to end right where the pre-scan expects, otherwise let the serial parser decide
+                if (!definitions[i] || !errors.empty() || cursor.pos != starts[i + 1]) {
+                    failed.store(true, std::memory_order_relaxed);
+                    break;
+                }
+            }
+        }
+
+        syntaxErrors = nullptr;
+        if (thread)
+            pools[thread] = takeNodePool(); // Nodes outlive the thread, its pool would be lost with it
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadsNum && i < groupsNum; i++)
+        threads.emplace_back(worker, i);
+    worker(0);
+    for (auto &thread : threads)
+        thread.join();
+
+    for (int i = 1; i < threadsNum; i++) {
+        mergeArena(astArena, &arenas[i]);
+        mergeNodePool(&pools[i]);
+    }
+
+    if (failed.load()) { // Reparse serially for the exact error report
+        tokenCursor_t cursor = makeTokenCursor(stream);
+        return getP(&cursor);
+    }
+
+    for (int i = 1; i < definitionsNum; i++) {
+        definitions[i]->left = definitions[i - 1];
+        definitions[i - 1]->parent = definitions[i];
+    }
+
+    return makeProgramTree(definitions[definitionsNum - 1]);
+}
+
+const useconds_t WATCH_INTERVAL = 100000; // Between two checks of the input file
+
+struct definitionSpan_t {
+    uint32_t start; // Source offset, the definition extends to the start of the next one or the end of the source
+    node_t *node; // D node
+};
+
+struct session_t { // Last successfully compiled version of the input
+    source_t source;
+    idTable_t identifiers; // Names are copied into names, so the table outlives every source version
+    int ownedNames; // Identifiers below this id have their names in names
+    arena_t names;
+    arena_t values; // AST values, also those of replaced definitions until the program is compacted
+    int liveValues; // Values reachable from program, one per node
+    std::vector<definitionSpan_t> definitions;
+    tree_t *program;
+};
+
+size_t commonPrefix(const char *first, const char *second, size_t size) {
+    const size_t BLOCK = 4096;
+
+    size_t same = 0;
+    while (size - same >= BLOCK && memcmp(first + same, second + same, BLOCK) == 0)
+        same += BLOCK;
+    while (same < size && first[same] == second[same])
+        same++;
+
+    return same;
+}
+
+size_t commonSuffix(const char *first, size_t firstSize, const char *second, size_t secondSize, size_t limit) {
+    const size_t BLOCK = 4096;
+
+    size_t same = 0;
+    while (limit - same >= BLOCK &&
+           memcmp(first + firstSize - same - BLOCK, second + secondSize - same - BLOCK, BLOCK) == 0)
+        same += BLOCK;
+    while (same < limit && first[firstSize - same - 1] == second[secondSize - same - 1])
+        same++;
+
+    return same;
+}
+
+bool ownIdentifierNames(session_t *session) { // Moves the names of new identifiers out of the source buffer
+    assert(session);
+
+    idTable_t *identifiers = &session->identifiers;
+    for (; session->ownedNames < identifiers->count; session->ownedNames++) {
+        int id = session->ownedNames;
+        auto name = (char *) arenaAlloc(&session->names, identifiers->lengths[id]);
+        if (!name)
+            return false;
+
+        memcpy(name, identifiers->names[id], identifiers->lengths[id]);
+        identifiers->names[id] = name;
+    }
+
+    return true;
+}
+
+bool recycleAstNode(node_t *node, void *recycled) {
+    freeNode(node);
+    (*(int *) recycled)++;
+    return true;
+}
+
+bool countAstNode(node_t *, void *count) {
+    (*(int *) count)++;
+    return true;
+}
+
+struct copyItem_t {
+    node_t *node; // Node of the old tree
+    node_t *parent; // Copy of its parent, nullptr for the head
+    bool left; // Side of the parent the node hangs on
+};
+
+node_t *copyAstTree(node_t *head, arena_t *values) { // Into the pool of the calling thread, nullptr if out of memory
+    assert(head);
+    assert(values);
+
+    node_t *copy = nullptr;
+    std::vector<copyItem_t> stack = {{head, nullptr, false}};
+    while (!stack.empty()) {
+        copyItem_t item = stack.back();
+        stack.pop_back();
+
+        auto value = (value_t *) arenaAlloc(values, sizeof(value_t));
+        node_t *node = value ? makeNode(item.parent, nullptr, nullptr, value) : nullptr;
+        if (!node)
+            return nullptr;
+        *value = *(value_t *) item.node->value;
+
+        if (!item.parent)
+            copy = node;
+        else if (item.left)
+            item.parent->left = node;
+        else
+            item.parent->right = node;
+
+        if (item.node->right)
+            stack.push_back({item.node->right, node, false});
+        if (item.node->left)
+            stack.push_back({item.node->left, node, true});
+    }
+
+    return copy;
+}
+
+// Drops nodes and values of replaced definitions once they outweigh the live ones.
+// A failed parse takes no memory with it, so replaced definitions are the only garbage and every node has a value
+void compactProgram(session_t *session) {
+    assert(session);
+
+    if (session->values.allocated <= 2 * sizeof(value_t) * session->liveValues + ARENA_BLOCK_SIZE)
+        return;
+
+    // Program is copied into an empty pool, the old one is then released as a whole
+    arena_t values = {};
+    nodePool_t old = takeNodePool();
+    node_t *head = copyAstTree(session->program->head, &values);
+    nodePool_t copied = takeNodePool();
+
+    mergeNodePool(head ? &old : &copied);
+    releaseNodePool();
+    mergeNodePool(head ? &copied : &old);
+    if (!head) {
+        freeArena(&values);
+        return;
+    }
+
+    freeArena(&session->values);
+    session->values = values; // astArena points at the session, so parsing continues in the new arena
+    session->program->head = head;
+
+    // Definitions are the chain hanging on the right of the head, the last one first
+    node_t *definition = head->right;
+    for (int i = (int) session->definitions.size() - 1; i >= 0; i--, definition = definition->left)
+        session->definitions[i].node = definition;
+}
+
+bool writeProgram(session_t *session) {
+    assert(session);
+
+    node_t *last = session->definitions.back().node;
+    if (!session->program) {
+        session->program = makeProgramTree(last);
+        session->liveValues++;
+    } else {
+        session->program->head->right = last;
+        last->parent = session->program->head;
+    }
+
+    flatAst_t ast = {};
+    if (!flattenTree(session->program, &ast)) {
+        printf("Not enough memory for AST\n");
+        return false;
+    }
+
+    bool saved = binaryOutput ? saveBinaryAst(&ast, &session->identifiers, output) : saveASTree(&ast, output) != 0;
+    freeFlatAst(&ast);
+
+    if (!saved)
+        printf("Unable to write output file %s\n", output);
+
+    return saved;
+}
+
+bool recompile(session_t *session, source_t *next) { // Takes over next if it compiles, even if the output is not written
+    assert(session);
+    assert(next);
+
+    auto started = std::chrono::steady_clock::now();
+
+    if (!isLexable(next))
+        return false;
+
+    // Changed bytes are [changed, oldSize - same) in the old version, widened to whole definitions
+    std::vector<definitionSpan_t> &definitions = session->definitions;
+    const source_t *old = &session->source;
+    size_t oldSize = definitions.empty() ? 0 : old->size;
+    size_t limit = oldSize < next->size ? oldSize : next->size;
+    size_t changed = definitions.empty() ? 0 : commonPrefix(old->data, next->data, limit);
+    if (changed == oldSize && changed == next->size && !definitions.empty())
+        return true;
+    size_t same = definitions.empty() ? 0 : commonSuffix(old->data, oldSize, next->data, next->size, limit - changed);
+
+    auto after = [&](size_t offset) { // First definition starting after offset
+        return std::upper_bound(definitions.begin(), definitions.end(), offset,
+                                [](size_t value, const definitionSpan_t &span) { return value < span.start; });
+    };
+
+    // A change touching a boundary takes in both definitions, so no token can cross the reparsed region
+    int first = 0;
+    int last = 0;
+    if (!definitions.empty()) {
+        first = after(changed) - definitions.begin() - 1;
+        if (first > 0 && definitions[first].start == changed)
+            first--;
+        last = after(oldSize - same) - definitions.begin();
+    }
+
+    size_t regionStart = definitions.empty() ? 0 : definitions[first].start;
+    size_t regionEnd = (last < (int) definitions.size() ? definitions[last].start : oldSize) + next->size - oldSize;
+
+    tokenStream_t tokens = {};
+    if (!initTokenStream(&tokens, next->data, estimateTokens(regionEnd - regionStart))) {
+        printf("Not enough memory for tokens\n");
+        freeTokenStream(&tokens);
+        return false;
+    }
+
+    lexer_t lexer = makeLexer(next->data, next->data + regionStart, next->data + regionEnd, &session->identifiers);
+    bool lexed = lexRange(&lexer, &tokens, INT_MAX, true) != LEX_FAILED;
+    if (!ownIdentifierNames(session)) {
+        printf("Not enough memory for identifiers\n");
+        lexed = false;
+    }
+    if (lexed && !finishTokenStream(&tokens, regionEnd)) {
+        printf("Not enough memory for tokens\n");
+        lexed = false;
+    }
+    if (!lexed) {
+        freeTokenStream(&tokens);
+        return false;
+    }
+
+    // Region may lose all its definitions, unless nothing else is left
+    std::vector<node_t *> parsed;
+    std::vector<int> starts;
+    int parsedValues = 0;
+    if (tokens.count || (first == 0 && last == (int) definitions.size())) {
+        // Region is parsed into a pool of its own, so the nodes of a broken version can all be dropped
+        nodePool_t kept = takeNodePool();
+        tokenCursor_t cursor = makeTokenCursor(&tokens);
+        tree_t *region = getP(&cursor);
+        if (!region)
+            releaseNodePool();
+        mergeNodePool(&kept);
+
+        if (!region) {
+            freeTokenStream(&tokens);
+            return false;
+        }
+
+        for (node_t *definition = region->head->right; definition; definition = definition->left)
+            parsed.push_back(definition);
+        std::reverse(parsed.begin(), parsed.end());
+        if (!parsed.empty())
+            treeTraverse(parsed.back(), countAstNode, &parsedValues); // Reaches the others through left
+
+        freeNode(region->head);
+        free(region);
+
+        findDefinitions(&tokens, &starts); // Parse has succeeded, so every labassistant outside blocks opens one
+        assert(starts.size() == parsed.size());
+    }
+
+    int recycledValues = 0;
+    for (int i = first; i < last; i++) {
+        definitions[i].node->left = nullptr;
+        treeTraverse(definitions[i].node, recycleAstNode, &recycledValues);
+    }
+    session->liveValues += parsedValues - recycledValues;
+
+    for (int i = last; i < (int) definitions.size(); i++)
+        definitions[i].start += next->size - oldSize;
+
+    std::vector<definitionSpan_t> spans(parsed.size());
+    for (int i = 0; i < (int) parsed.size(); i++)
+        spans[i] = {i ? tokens.offsets[starts[i]] : (uint32_t) regionStart, parsed[i]};
+
+    definitions.erase(definitions.begin() + first, definitions.begin() + last);
+    definitions.insert(definitions.begin() + first, spans.begin(), spans.end());
+    definitions[0].start = 0; // Text before the first definition belongs to it
+
+    for (int i = 0; i < (int) definitions.size(); i++) {
+        node_t *node = definitions[i].node;
+        node->left = i ? definitions[i - 1].node : nullptr;
+        if (i)
+            node->left->parent = node;
+    }
+
+    freeTokenStream(&tokens);
+    freeSource(&session->source);
+    session->source = *next;
+    *next = {};
+
+    // New version is already in place, a failed write leaves the output behind it until the next change
+    double parseTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    bool written = writeProgram(session);
+    compactProgram(session);
+    double totalTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+    if (written) {
+        printf("Reparsed %d of %d definitions (%d tokens) in %.3f ms, wrote %s in %.3f ms\n", (int) parsed.size(),
+               (int) definitions.size(), lexer.tokensNum, parseTime, output, totalTime - parseTime);
+    } else {
+        printf("Reparsed %d of %d definitions (%d tokens) in %.3f ms, %s is out of date until the next change\n",
+               (int) parsed.size(), (int) definitions.size(), lexer.tokensNum, parseTime, output);
+    }
+
+    return true;
+}
+
+int watchSource() { // Never returns unless setup fails
+    if (strcmp(input, "-") == 0) {
+        printf("Watching needs an input file\n");
+        return 1;
+    }
+
+    session_t session = {};
+    if (!initIdTable(&session.identifiers)) {
+        printf("Not enough memory for identifiers\n");
+        return 1;
+    }
+
+    IDs = &session.identifiers;
+    astArena = &session.values;
+
+    printf("Watching %s, output %s\n", input, output);
+
+    struct stat seen = {};
+    while (true) {
+        struct stat info = {};
+        bool modified = stat(input, &info) == 0 &&
+                        (info.st_mtim.tv_sec != seen.st_mtim.tv_sec || info.st_mtim.tv_nsec != seen.st_mtim.tv_nsec ||
+                         info.st_size != seen.st_size || info.st_ino != seen.st_ino);
+
+        if (modified) {
+            seen = info;
+
+            // Heap copy instead of a mapping, so rewriting the file in place cannot change the previous version
+            source_t next = {};
+            int fd = open(input, O_RDONLY);
+            if (fd >= 0 && readSource(fd, &next)) {
+                if (!recompile(&session, &next))
+                    printf("Keeping the last compiled version\n");
+                freeSource(&next);
+            } else {
+                printf("Unable to read input file %s\n", input);
+            }
+
+            if (fd >= 0)
+                close(fd);
+            fflush(stdout);
+        }
+
+        usleep(WATCH_INTERVAL);
+    }
+}
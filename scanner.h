@@ -0,0 +1,132 @@
+#ifndef _SCANNER_
+#define _SCANNER_
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86
+#endif
+
+// Whitespace and word (letters and '_') run scanners.
+// Vector versions may read up to 31 bytes past the end of the run, so input must be padded
+
+const char *skipSpacesScalar(const char *str) {
+    while (*str == ' ' || (unsigned char) (*str - '\t') <= '\r' - '\t')
+        str++;
+
+    return str;
+}
+
+const char *skipWordScalar(const char *str) {
+    while ((unsigned char) ((*str | 0x20) - 'a') <= 'z' - 'a' || *str == '_')
+        str++;
+
+    return str;
+}
+
+#ifdef SCANNER_X86
+
+__attribute__((target("sse2")))
+const char *skipSpacesSSE2(const char *str) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i controlRange = _mm_set1_epi8('\r' - '\t');
+    const __m128i zero = _mm_setzero_si128();
+
+    while (true) {
+        __m128i chars = _mm_loadu_si128((const __m128i *) str);
+        __m128i control = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(chars, tab), controlRange), zero);
+        __m128i spaces = _mm_or_si128(_mm_cmpeq_epi8(chars, space), control);
+
+        unsigned mask = ~_mm_movemask_epi8(spaces) & 0xFFFF;
+        if (mask)
+            return str + __builtin_ctz(mask);
+
+        str += 16;
+    }
+}
+
+__attribute__((target("sse2")))
+const char *skipWordSSE2(const char *str) {
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    const __m128i lowerA = _mm_set1_epi8('a');
+    const __m128i letterRange = _mm_set1_epi8('z' - 'a');
+    const __m128i underscore = _mm_set1_epi8('_');
+    const __m128i zero = _mm_setzero_si128();
+
+    while (true) {
+        __m128i chars = _mm_loadu_si128((const __m128i *) str);
+        __m128i lower = _mm_sub_epi8(_mm_or_si128(chars, caseBit), lowerA);
+        __m128i letters = _mm_cmpeq_epi8(_mm_subs_epu8(lower, letterRange), zero);
+        __m128i word = _mm_or_si128(letters, _mm_cmpeq_epi8(chars, underscore));
+
+        unsigned mask = ~_mm_movemask_epi8(word) & 0xFFFF;
+        if (mask)
+            return str + __builtin_ctz(mask);
+
+        str += 16;
+    }
+}
+
+__attribute__((target("avx2")))
+const char *skipSpacesAVX2(const char *str) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i controlRange = _mm256_set1_epi8('\r' - '\t');
+    const __m256i zero = _mm256_setzero_si256();
+
+    while (true) {
+        __m256i chars = _mm256_loadu_si256((const __m256i *) str);
+        __m256i control = _mm256_cmpeq_epi8(_mm256_subs_epu8(_mm256_sub_epi8(chars, tab), controlRange), zero);
+        __m256i spaces = _mm256_or_si256(_mm256_cmpeq_epi8(chars, space), control);
+
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(spaces);
+        if (mask)
+            return str + __builtin_ctz(mask);
+
+        str += 32;
+    }
+}
+
+__attribute__((target("avx2")))
+const char *skipWordAVX2(const char *str) {
+    const __m256i caseBit = _mm256_set1_epi8(0x20);
+    const __m256i lowerA = _mm256_set1_epi8('a');
+    const __m256i letterRange = _mm256_set1_epi8('z' - 'a');
+    const __m256i underscore = _mm256_set1_epi8('_');
+    const __m256i zero = _mm256_setzero_si256();
+
+    while (true) {
+        __m256i chars = _mm256_loadu_si256((const __m256i *) str);
+        __m256i lower = _mm256_sub_epi8(_mm256_or_si256(chars, caseBit), lowerA);
+        __m256i letters = _mm256_cmpeq_epi8(_mm256_subs_epu8(lower, letterRange), zero);
+        __m256i word = _mm256_or_si256(letters, _mm256_cmpeq_epi8(chars, underscore));
+
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(word);
+        if (mask)
+            return str + __builtin_ctz(mask);
+
+        str += 32;
+    }
+}
+
+#endif
+
+struct scanner_t {
+    const char *(*skipSpaces)(const char *str);
+    const char *(*skipWord)(const char *str);
+};
+
+scanner_t getScanner() { // Picks the widest vector unit available at run time
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {skipSpacesAVX2, skipWordAVX2};
+    if (__builtin_cpu_supports("sse2"))
+        return {skipSpacesSSE2, skipWordSSE2};
+#endif
+    return {skipSpacesScalar, skipWordScalar};
+}
+
+#endif
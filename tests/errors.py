@@ -0,0 +1,30 @@
+#!/usr/bin/env python3
+# Programs with syntax errors report every error in one pass, the same way in every parsing mode.
+# Each <name>.chem has its expected report in <name>.expected.
+# Usage: errors.py <ChemLang> <errors directory>
+
+import os
+import sys
+
+import harness
+from harness import MODES, fail, run
+
+
+def check(compiler, work, directory):
+    for program in sorted(os.listdir(directory)):
+        if not program.endswith(".chem"):
+            continue
+
+        path = os.path.join(directory, program)
+        with open(os.path.splitext(path)[0] + ".expected") as f:
+            expected = f.read()
+
+        for mode in MODES:
+            result = run(compiler, *mode, "-i", path, "-o", os.path.join(work, "out.ast"))
+            if result.returncode != 1 or result.stdout != expected:
+                fail("%s %s: exit code %d, report:\n%s" %
+                     (program, harness.describe(mode), result.returncode, result.stdout))
+
+
+if __name__ == "__main__":
+    sys.exit(harness.main(check))
@@ -0,0 +1,44 @@
+# Shared by the test scripts: parsing modes, running the compiler and collecting failures.
+# A script defines check(compiler, work, *arguments) and ends with sys.exit(harness.main(check)),
+# where work is a temporary directory and arguments are the command line after the compiler
+
+import os
+import subprocess
+import sys
+import tempfile
+
+# Every way of getting from source to AST, all of them have to behave the same
+MODES = [[], ["-e"], ["-p"], ["-j", "4"]]
+
+failures = []
+
+
+def fail(message):
+    failures.append(message)
+
+
+def describe(mode):
+    return " ".join(mode) or "default"
+
+
+def run(compiler, *args):  # Output comes back as text, a crash is a failure of its own
+    result = subprocess.run([compiler, *args], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True,
+                            errors="replace")
+    if result.returncode < 0:
+        fail("%s crashed with signal %d" % (" ".join(args), -result.returncode))
+    return result
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main(check):
+    with tempfile.TemporaryDirectory() as work:
+        check(os.path.abspath(sys.argv[1]), work, *sys.argv[2:])
+
+    for failure in failures:
+        print(failure)
+
+    return 1 if failures else 0
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# Peak memory of a compilation grows with the token count, not with the source size.
+# The input is about 100 MB of mostly whitespace; the mapped source is resident as well, so it is part of the bound.
+# Usage: memory.py <ChemLang>
+
+import os
+import sys
+
+import harness
+from harness import MODES, fail
+
+STATEMENTS = 470000
+PADDING = 200
+STATEMENT_TOKENS = 6  # x is x add H ;
+PROGRAM_TOKENS = 8  # labassistant f ( x ) labprotocol ... endprotocol and the end
+
+BYTES_PER_TOKEN = 128  # Tokens, identifiers, AST nodes and values
+BASE_BYTES = 32 << 20
+
+
+def check(compiler, work):
+    source_path = os.path.join(work, "memory.chem")
+    ast_path = os.path.join(work, "memory.ast")
+
+    with open(source_path, "w") as f:
+        f.write("labassistant f(x) labprotocol\n")
+        f.write(("x is x add H;" + " " * PADDING + "\n") * STATEMENTS)
+        f.write("endprotocol\n")
+
+    tokens = STATEMENTS * STATEMENT_TOKENS + PROGRAM_TOKENS
+    bound = os.path.getsize(source_path) + BYTES_PER_TOKEN * tokens + BASE_BYTES
+
+    for mode in MODES:
+        # Forked rather than run so that the peak belongs to the compiler alone
+        pid = os.fork()
+        if pid == 0:
+            os.dup2(os.open(os.devnull, os.O_WRONLY), 1)
+            os.execv(compiler, [compiler, *mode, "-i", source_path, "-o", ast_path])
+
+        _, status, usage = os.wait4(pid, 0)
+        peak = usage.ru_maxrss * 1024  # Kilobytes on Linux
+        what = "%s: peak RSS %d MB, bound %d MB" % (harness.describe(mode), peak >> 20, bound >> 20)
+        print(what)
+
+        if os.waitstatus_to_exitcode(status) != 0:
+            fail("%s: exit code %d" % (what, os.waitstatus_to_exitcode(status)))
+        elif peak > bound:
+            fail(what)
+
+
+if __name__ == "__main__":
+    sys.exit(harness.main(check))
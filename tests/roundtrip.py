@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+# Every parsing mode writes the same AST, and saved ASTs read back with -r are written out unchanged.
+# Malformed and unusual saved ASTs must be rejected or converted, never crash the compiler.
+# Usage: roundtrip.py <ChemLang> <programs directory>
+
+import json
+import os
+import struct
+import sys
+
+import harness
+from harness import MODES, fail, read, run
+
+# Accepted by the loader although the parser never produces them
+UNUSUAL = [
+    "{ PROGRAM_ROOT { @ } { DECLARATION { @ } { x } } }",
+    "{ PROGRAM_ROOT { @ } { DECLARATION { @ } { FUNCTION { VARLIST } { @ } } } }",
+    "{ PROGRAM_ROOT { @ } { DECLARATION { @ } { @ } } }",
+    "{x{a}{b}}",
+    '{ PROGRAM_ROOT { @ } { DECLARATION { @ } { FUNCTION { VARLIST } { a"b\\c\x01 { @ } { BLOCK } } } } }',
+]
+
+MALFORMED = [
+    "",
+    "{",
+    "{ }",
+    "{ @ }",
+    "{ PROGRAM_ROOT { @ } { DECLARATION { @ } }",
+    "{ PROGRAM_ROOT { @ } { DECLARATION { @ } { x } } } }",
+    "{ BLOCK { @ } { OP { @ } { x } }",
+    "{ VARLIST { VARLIST { @ } { x } }",
+    "{ x { a } { b } { c } }",
+    "{ 99999999999 }",
+    "{ PROGRAM_ROOT { @ } { DECLARATION { @ } { x } } }\0garbage{{{",
+]
+
+# Binary AST header: magic, version, nodes, strings, definitions, reserved, then the section offsets and the size
+HEADER = struct.Struct("<4s5I5Q")
+
+def expect_same(what, first, second):
+    if read(first) != read(second):
+        fail("%s: %s and %s differ" % (what, first, second))
+
+
+def check_trace(what, path):
+    try:
+        with open(path, encoding="utf-8") as f:
+            records = [json.loads(line) for line in f]
+    except (OSError, ValueError) as error:
+        fail("%s: trace is not JSON Lines: %s" % (what, error))
+        return []
+
+    return records
+
+
+def check_program(compiler, program, work):
+    name = os.path.splitext(os.path.basename(program))[0]
+    text = os.path.join(work, name + ".ast")
+    binary = os.path.join(work, name + ".bin")
+
+    if run(compiler, "-i", program, "-o", text).returncode != 0:
+        fail("%s does not compile" % program)
+        return
+
+    for mode in MODES:
+        other = os.path.join(work, name + "-mode.ast")
+        if run(compiler, *mode, "-i", program, "-o", other).returncode != 0:
+            fail("%s does not compile with %s" % (program, harness.describe(mode)))
+        else:
+            expect_same("%s %s" % (name, harness.describe(mode)), text, other)
+
+    reloaded = os.path.join(work, name + "-reloaded.ast")
+    if run(compiler, "-r", "-i", text, "-o", reloaded).returncode != 0:
+        fail("%s does not load back" % text)
+    else:
+        expect_same(name + " save -> load -> save", text, reloaded)
+
+    trace = os.path.join(work, name + ".jsonl")
+    if run(compiler, "-t", trace, "-i", program, "-o", os.path.join(work, name + "-traced.ast")).returncode != 0:
+        fail("%s does not compile with a trace" % program)
+    elif not any(record["event"] == "node" for record in check_trace(name, trace)):
+        fail("%s: trace has no AST nodes" % name)
+
+    converted = os.path.join(work, name + "-converted.bin")
+    if run(compiler, "-b", "-i", program, "-o", binary).returncode != 0 or \
+            run(compiler, "-r", "-b", "-i", text, "-o", converted).returncode != 0:
+        fail("%s has no binary AST" % program)
+        return
+
+    for source in [binary, converted]:
+        decoded = os.path.join(work, name + "-decoded.ast")
+        if run(compiler, "-r", "-i", source, "-o", decoded).returncode != 0:
+            fail("%s does not load back" % source)
+        else:
+            expect_same(name + " binary -> text", text, decoded)
+
+    check_corrupted(compiler, binary, work)
+    check_functions(compiler, text, binary, work)
+
+
+def subtree_end(words, start):  # Index past the node opened by the "{" at start
+    depth = 0
+    for i in range(start, len(words)):
+        depth += {"{": 1, "}": -1}.get(words[i], 0)
+        if depth == 0:
+            return i + 1
+    return len(words)
+
+
+def check_functions(compiler, text, binary, work):
+    # Every function read alone through the table of contents is its subtree of the whole AST
+    words = read(text).decode().split()
+    functions = {}
+    for i in range(1, len(words)):
+        if words[i] == "FUNCTION" and words[i - 1] == "{":
+            name = words[subtree_end(words, i + 1) + 1]
+            functions[name] = " ".join(words[i - 1:subtree_end(words, i - 1)]) + " "
+
+    path = os.path.join(work, "function.ast")
+    for name, subtree in functions.items():
+        if run(compiler, "-r", "-f", name, "-i", binary, "-o", path).returncode != 0:
+            fail("%s: function %s does not load" % (binary, name))
+        elif read(path).decode() != subtree:
+            fail("%s: function %s differs from its subtree" % (binary, name))
+
+    if run(compiler, "-r", "-f", "missing", "-i", binary, "-o", path).returncode == 0:
+        fail("%s: missing function is found" % binary)
+
+    # An entry pointing at another function is rejected although its nodes are consistent
+    data = read(binary)
+    _, _, _, _, definitions, _, _, _, definitions_at, _, _ = HEADER.unpack_from(data)
+    if definitions < 2:
+        return
+
+    corrupted = bytearray(data)
+    corrupted[definitions_at + 4:definitions_at + 12] = data[definitions_at + 20:definitions_at + 28]
+    with open(os.path.join(work, "swapped.bin"), "wb") as f:
+        f.write(corrupted)
+
+    name_at = struct.unpack_from("<I", data, definitions_at)[0]
+    offsets_at, data_at = HEADER.unpack_from(data)[6:8]
+    start, end = struct.unpack_from("<II", data, offsets_at + 4 * name_at)
+    name = data[data_at + start:data_at + end].decode()
+    if run(compiler, "-r", "-f", name, "-i", os.path.join(work, "swapped.bin"), "-o", path).returncode == 0:
+        fail("%s: entry of %s pointing at another function is accepted" % (binary, name))
+
+
+def check_corrupted(compiler, binary, work):
+    data = read(binary)
+    magic, version, nodes, strings, definitions, _, offsets_at, data_at, definitions_at, nodes_at, size = \
+        HEADER.unpack_from(data)
+
+    def patch(at, fmt, value):
+        corrupted = bytearray(data)
+        struct.pack_into(fmt, corrupted, at, value)
+        return bytes(corrupted)
+
+    cases = {
+        "truncated": data[:-8],
+        "version": patch(4, "<I", version + 1),
+        "wrapping nodes offset": patch(48, "<Q", 2 ** 64 - 8),
+        "decreasing string offsets": patch(offsets_at + 4, "<I", 0xffffffff),
+        "empty root": patch(nodes_at + 12, "<I", 0),
+        "oversized root": patch(nodes_at + 12, "<I", nodes + 1),
+    }
+    if definitions:
+        cases["definition name"] = patch(definitions_at, "<I", strings)
+        cases["definition first node"] = patch(definitions_at + 4, "<I", nodes)
+        cases["definition nodes"] = patch(definitions_at + 8, "<I", nodes)
+
+    path = os.path.join(work, "corrupted.bin")
+    for case, corrupted in cases.items():
+        with open(path, "wb") as f:
+            f.write(corrupted)
+
+        if run(compiler, "-r", "-i", path, "-o", os.path.join(work, "corrupted.ast")).returncode == 0:
+            fail("%s: binary AST with %s is accepted" % (binary, case))
+
+
+def check_saved(compiler, saved, work, accepted):
+    path = os.path.join(work, "saved.ast")
+    with open(path, "w") as f:
+        f.write(saved)
+
+    for binary in [[], ["-b"]]:
+        trace = os.path.join(work, "saved.jsonl")
+        result = run(compiler, "-r", *binary, "-t", trace, "-i", path, "-o", os.path.join(work, "saved.out"))
+        if result.returncode == 0:
+            check_trace(repr(saved), trace)
+        if accepted and result.returncode != 0:
+            fail("%r %s is rejected" % (saved, " ".join(binary)))
+        if not accepted and result.returncode == 0:
+            fail("%r %s is accepted" % (saved, " ".join(binary)))
+
+
+def check(compiler, work, programs):
+    for program in sorted(os.listdir(programs)):
+        if program.endswith(".chem"):
+            check_program(compiler, os.path.join(programs, program), work)
+
+    for saved in UNUSUAL:
+        check_saved(compiler, saved, work, True)
+    for saved in MALFORMED:
+        check_saved(compiler, saved, work, False)
+
+
+if __name__ == "__main__":
+    sys.exit(harness.main(check))
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# Huge generated programs: a million statements in one block, and blocks and expressions nested a hundred
+# thousand levels deep. Every parsing mode has to write exactly the expected AST.
+# Usage: stress.py <ChemLang>
+
+import os
+import sys
+
+import harness
+from harness import MODES, fail, run
+
+STATEMENTS = 1000000
+DEPTH = 100000
+
+STATEMENT = "x is x add H;\n"
+STATEMENT_AST = "{ ASSIGN { x } { ADD { x } { 0 } } } "
+
+# Saved AST is a preorder of nodes, every word followed by a space
+HEADER_AST = "{ PROGRAM_ROOT { @ } { DECLARATION { @ } { FUNCTION { VARLIST { @ } { x } } { f { @ } "
+FOOTER_AST = "} } } } "
+
+
+def program(body):
+    return "labassistant f(x) labprotocol\n" + body + "endprotocol\n"
+
+
+def flat_block():
+    # Statements of a block are a chain of OP nodes linked through the left child
+    source = program(STATEMENT * STATEMENTS)
+    ast = HEADER_AST + "{ BLOCK { @ } " + "{ OP " * STATEMENTS + "{ @ } " + (STATEMENT_AST + "} ") * STATEMENTS
+    return source, ast + "} " + FOOTER_AST
+
+
+def nested_blocks():
+    source = program("taste (x) labprotocol\n" * DEPTH + STATEMENT + "endprotocol\n" * DEPTH)
+    ast = (HEADER_AST + "{ BLOCK { @ } { OP { @ } { IF { x } { C { @ } " * DEPTH +
+           "{ BLOCK { @ } { OP { @ } " + STATEMENT_AST + "} } " + "} } } } " * DEPTH)
+    return source, ast + FOOTER_AST
+
+
+def nested_expression():
+    source = program("x is " + "x add (" * DEPTH + "x" + ")" * DEPTH + ";\n")
+    ast = (HEADER_AST + "{ BLOCK { @ } { OP { @ } { ASSIGN { x } " + "{ ADD { x } " * DEPTH + "{ x } " +
+           "} " * DEPTH + "} } } ")
+    return source, ast + FOOTER_AST
+
+
+def check(compiler, work):
+    source_path = os.path.join(work, "stress.chem")
+    ast_path = os.path.join(work, "stress.ast")
+
+    for generate in [flat_block, nested_blocks, nested_expression]:
+        source, expected = generate()
+        with open(source_path, "w") as f:
+            f.write(source)
+
+        for mode in MODES:
+            what = "%s %s" % (generate.__name__, harness.describe(mode))
+            result = run(compiler, *mode, "-i", source_path, "-o", ast_path)
+            if result.returncode != 0:
+                fail("%s: exit code %d\n%s" % (what, result.returncode, result.stdout[-1000:]))
+                continue
+
+            with open(ast_path) as f:
+                if f.read() != expected:
+                    fail("%s: unexpected AST" % what)
+
+
+if __name__ == "__main__":
+    sys.exit(harness.main(check))
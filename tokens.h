@@ -0,0 +1,344 @@
+#ifndef _TOKENS_
+#define _TOKENS_
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+// Packed structure-of-arrays token stream.
+// Every token is one 32-bit word (kind in the low bits, id above), its source position lives in a parallel array
+// of byte offsets that is only turned into line and column when somebody asks for it
+
+enum TOKEN_TYPE {
+    END,
+    KEYWORD,
+    SPECIAL_SYMBOL,
+    IDENTIFIER,
+    NUMBER
+};
+
+const int TOKEN_KIND_BITS = 3;
+const uint32_t TOKEN_KIND_MASK = (1u << TOKEN_KIND_BITS) - 1;
+const uint32_t TOKEN_ID_LIMIT = UINT32_MAX >> TOKEN_KIND_BITS;
+
+const int BYTES_PER_TOKEN_ESTIMATE = 6;
+
+struct tokenStream_t {
+    uint32_t *words; // Packed kind + id, followed by an END token
+    uint32_t *offsets; // Byte offset of every token in the source
+    int count; // Tokens without the trailing END
+    int capacity;
+
+    int *numbers; // Values of NUMBER tokens, their id indexes here since a value may not fit in the id bits
+    int numbersCount;
+    int numbersCapacity;
+
+    const char *source;
+    uint32_t *lineStarts; // Built on the first position query
+    int linesCount;
+};
+
+const int TOKEN_LOOKAHEAD = 1; // Tokens the parser may peek past the current one
+
+struct tokenCursor_t {
+    tokenStream_t *stream; // Whole program, or a window of it when refill is set
+    int pos;
+
+    // Called when fewer than TOKEN_LOOKAHEAD tokens remain after pos; it may drop consumed tokens and
+    // has to either append more or finish the stream. Reset to nullptr once the stream is finished
+    void (*refill)(tokenCursor_t *cursor);
+    void *lexer;
+    bool failed; // Lexer error already reported, the stream was cut short
+};
+
+inline uint32_t packToken(TOKEN_TYPE type, uint32_t id) {
+    return type | (id << TOKEN_KIND_BITS);
+}
+
+inline TOKEN_TYPE unpackTokenType(uint32_t word) {
+    return (TOKEN_TYPE) (word & TOKEN_KIND_MASK);
+}
+
+inline uint32_t unpackTokenId(uint32_t word) {
+    return word >> TOKEN_KIND_BITS;
+}
+
+int estimateTokens(size_t size) { // Grow from an estimate of token density instead of one token per source byte
+    return size / BYTES_PER_TOKEN_ESTIMATE + 16;
+}
+
+bool initTokenStream(tokenStream_t *stream, const char *source, int capacity) {
+    assert(stream);
+    assert(source);
+
+    *stream = {};
+    stream->source = source;
+
+    stream->capacity = capacity;
+    stream->words = (uint32_t *) malloc(sizeof(uint32_t) * stream->capacity);
+    stream->offsets = (uint32_t *) malloc(sizeof(uint32_t) * stream->capacity);
+
+    return stream->words && stream->offsets;
+}
+
+void freeTokenStream(tokenStream_t *stream) {
+    assert(stream);
+
+    free(stream->words);
+    free(stream->offsets);
+    free(stream->numbers);
+    free(stream->lineStarts);
+
+    *stream = {};
+}
+
+bool reserveTokens(tokenStream_t *stream) {
+    assert(stream);
+
+    if (stream->count < stream->capacity)
+        return true;
+
+    int capacity = stream->capacity + stream->capacity / 2 + 16;
+
+    auto words = (uint32_t *) realloc(stream->words, sizeof(uint32_t) * capacity);
+    if (!words)
+        return false;
+    stream->words = words;
+
+    auto offsets = (uint32_t *) realloc(stream->offsets, sizeof(uint32_t) * capacity);
+    if (!offsets)
+        return false;
+    stream->offsets = offsets;
+
+    stream->capacity = capacity;
+
+    return true;
+}
+
+bool pushToken(tokenStream_t *stream, TOKEN_TYPE type, uint32_t id, uint32_t offset) {
+    assert(stream);
+    assert(id <= TOKEN_ID_LIMIT);
+
+    if (!reserveTokens(stream))
+        return false;
+
+    stream->words[stream->count] = packToken(type, id);
+    stream->offsets[stream->count] = offset;
+    stream->count++;
+
+    return true;
+}
+
+bool pushNumberToken(tokenStream_t *stream, int value, uint32_t offset) {
+    assert(stream);
+
+    if (stream->numbersCount == stream->numbersCapacity) {
+        int capacity = stream->numbersCapacity ? stream->numbersCapacity * 2 : 64;
+        auto numbers = (int *) realloc(stream->numbers, sizeof(int) * capacity);
+        if (!numbers)
+            return false;
+
+        stream->numbers = numbers;
+        stream->numbersCapacity = capacity;
+    }
+
+    if (!pushToken(stream, NUMBER, stream->numbersCount, offset))
+        return false;
+
+    stream->numbers[stream->numbersCount++] = value;
+
+    return true;
+}
+
+bool appendTokens(tokenStream_t *stream, const tokenStream_t *tokens) { // Source positions have to share the origin
+    assert(stream);
+    assert(tokens);
+
+    for (int i = 0; i < tokens->count; i++) {
+        uint32_t word = tokens->words[i];
+        TOKEN_TYPE type = unpackTokenType(word);
+
+        bool added = type == NUMBER ? pushNumberToken(stream, tokens->numbers[unpackTokenId(word)], tokens->offsets[i])
+                                    : pushToken(stream, type, unpackTokenId(word), tokens->offsets[i]);
+        if (!added)
+            return false;
+    }
+
+    return true;
+}
+
+bool finishTokenStream(tokenStream_t *stream, uint32_t offset) { // Appends END, which is not counted, and trims the arrays
+    assert(stream);
+
+    if (!pushToken(stream, END, 0, offset))
+        return false;
+    stream->count--;
+
+    int used = stream->count + 1;
+    if (auto words = (uint32_t *) realloc(stream->words, sizeof(uint32_t) * used))
+        stream->words = words;
+    if (auto offsets = (uint32_t *) realloc(stream->offsets, sizeof(uint32_t) * used))
+        stream->offsets = offsets;
+    stream->capacity = used;
+
+    return true;
+}
+
+TOKEN_TYPE getTokenType(const tokenStream_t *stream, int index) {
+    assert(stream);
+    assert(index >= 0 && index <= stream->count);
+
+    return unpackTokenType(stream->words[index]);
+}
+
+int getTokenId(const tokenStream_t *stream, int index) { // Value for NUMBER tokens
+    assert(stream);
+    assert(index >= 0 && index <= stream->count);
+
+    uint32_t word = stream->words[index];
+    if (unpackTokenType(word) == NUMBER)
+        return stream->numbers[unpackTokenId(word)];
+
+    return (int) unpackTokenId(word);
+}
+
+bool buildLineStarts(tokenStream_t *stream) {
+    assert(stream);
+
+    int capacity = 1024;
+    auto starts = (uint32_t *) malloc(sizeof(uint32_t) * capacity);
+    if (!starts)
+        return false;
+
+    int lines = 0;
+    starts[lines++] = 0;
+
+    const char *current = stream->source;
+    while (const char *newline = strchr(current, '\n')) {
+        if (lines == capacity) {
+            capacity *= 2;
+            auto grown = (uint32_t *) realloc(starts, sizeof(uint32_t) * capacity);
+            if (!grown) {
+                free(starts);
+                return false;
+            }
+            starts = grown;
+        }
+
+        current = newline + 1;
+        starts[lines++] = current - stream->source;
+    }
+
+    stream->lineStarts = starts;
+    stream->linesCount = lines;
+
+    return true;
+}
+
+bool getOffsetPosition(tokenStream_t *stream, uint32_t offset, int *line, int *column) { // Both 1-based
+    assert(stream);
+    assert(line);
+    assert(column);
+
+    if (!stream->lineStarts && !buildLineStarts(stream))
+        return false;
+
+    int low = 0;
+    int high = stream->linesCount;
+    while (high - low > 1) {
+        int middle = (low + high) / 2;
+        if (stream->lineStarts[middle] <= offset)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    *line = low + 1;
+    *column = offset - stream->lineStarts[low] + 1;
+
+    return true;
+}
+
+tokenCursor_t makeTokenCursor(tokenStream_t *stream) {
+    assert(stream);
+
+    return {stream, 0, nullptr, nullptr, false};
+}
+
+tokenCursor_t makeTokenCursor(tokenStream_t *stream, void (*refill)(tokenCursor_t *), void *lexer) {
+    assert(stream);
+    assert(refill);
+
+    tokenCursor_t cursor = {stream, 0, refill, lexer, false};
+    refill(&cursor);
+
+    return cursor;
+}
+
+void dropConsumedTokens(tokenCursor_t *cursor) { // Moves the unread tail of the window to its start
+    assert(cursor);
+
+    tokenStream_t *stream = cursor->stream;
+    int left = stream->count - cursor->pos;
+
+    memmove(stream->words, stream->words + cursor->pos, sizeof(uint32_t) * left);
+    memmove(stream->offsets, stream->offsets + cursor->pos, sizeof(uint32_t) * left);
+    stream->count = left;
+    cursor->pos = 0;
+
+    // NUMBER ids only grow along the stream, so the kept values can be packed in place
+    stream->numbersCount = 0;
+    for (int i = 0; i < left; i++) {
+        if (unpackTokenType(stream->words[i]) != NUMBER)
+            continue;
+
+        stream->numbers[stream->numbersCount] = stream->numbers[unpackTokenId(stream->words[i])];
+        stream->words[i] = packToken(NUMBER, stream->numbersCount);
+        stream->numbersCount++;
+    }
+}
+
+inline TOKEN_TYPE tokenType(const tokenCursor_t *cursor, int ahead = 0) { // Looking past the end gives END
+    int index = cursor->pos + ahead;
+    if (index > cursor->stream->count)
+        index = cursor->stream->count;
+
+    return unpackTokenType(cursor->stream->words[index]);
+}
+
+inline int tokenId(const tokenCursor_t *cursor) {
+    return getTokenId(cursor->stream, cursor->pos);
+}
+
+inline bool isKeyword(const tokenCursor_t *cursor, int keywordID, int ahead = 0) {
+    int index = cursor->pos + ahead;
+    if (index > cursor->stream->count)
+        return false;
+
+    return cursor->stream->words[index] == packToken(KEYWORD, keywordID);
+}
+
+inline bool isSymbol(const tokenCursor_t *cursor, int symbolID, int ahead = 0) {
+    int index = cursor->pos + ahead;
+    if (index > cursor->stream->count)
+        return false;
+
+    return cursor->stream->words[index] == packToken(SPECIAL_SYMBOL, symbolID);
+}
+
+inline void seekToken(tokenCursor_t *cursor, int pos) { // Only for complete streams
+    assert(!cursor->refill);
+    assert(pos >= 0 && pos <= cursor->stream->count);
+
+    cursor->pos = pos;
+}
+
+inline void advanceToken(tokenCursor_t *cursor) {
+    if (cursor->pos < cursor->stream->count) // END is never consumed
+        cursor->pos++;
+
+    if (cursor->refill && cursor->pos + TOKEN_LOOKAHEAD >= cursor->stream->count)
+        cursor->refill(cursor);
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef _WRITER_
+#define _WRITER_
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+
+// Buffered output straight to a file descriptor.
+// Text is rendered into one large buffer that is reused by every writer of the thread and flushed with big write calls.
+// A writer opened while another one is still open gets a buffer of its own
+
+const size_t WRITER_BUFFER_SIZE = 1 << 20;
+
+struct writer_t {
+    int fd;
+    char *buffer;
+    size_t used;
+    size_t written; // Bytes flushed so far
+    bool failed;
+    bool shared; // Buffer is the reused one of the thread
+};
+
+thread_local char *sharedWriterBuffer = nullptr;
+thread_local bool sharedWriterBusy = false;
+
+bool openWriter(writer_t *writer, const char *filename) {
+    assert(writer);
+    assert(filename);
+
+    *writer = {-1, nullptr, 0, 0, false, !sharedWriterBusy};
+    if (writer->shared) {
+        if (!sharedWriterBuffer)
+            sharedWriterBuffer = (char *) malloc(WRITER_BUFFER_SIZE);
+
+        writer->buffer = sharedWriterBuffer;
+        sharedWriterBusy = writer->buffer;
+    } else {
+        writer->buffer = (char *) malloc(WRITER_BUFFER_SIZE);
+    }
+
+    if (!writer->buffer)
+        return false;
+
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    return writer->fd >= 0;
+}
+
+bool writeAll(int fd, const char *data, size_t size) {
+    while (size) {
+        ssize_t done = write(fd, data, size);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return false;
+
+        data += done;
+        size -= done;
+    }
+
+    return true;
+}
+
+void flushWriter(writer_t *writer) {
+    assert(writer);
+
+    if (!writer->failed && !writeAll(writer->fd, writer->buffer, writer->used))
+        writer->failed = true;
+
+    writer->written += writer->used;
+    writer->used = 0;
+}
+
+bool closeWriter(writer_t *writer) { // false if anything could not be written
+    assert(writer);
+
+    if (writer->fd >= 0) {
+        flushWriter(writer);
+        if (close(writer->fd) != 0)
+            writer->failed = true;
+    } else {
+        writer->failed = true;
+    }
+
+    writer->fd = -1;
+
+    if (writer->shared)
+        sharedWriterBusy = false;
+    else
+        free(writer->buffer);
+    writer->buffer = nullptr;
+
+    return !writer->failed;
+}
+
+inline void writeBytes(writer_t *writer, const char *data, size_t size) {
+    if (WRITER_BUFFER_SIZE - writer->used < size) {
+        flushWriter(writer);
+
+        if (size >= WRITER_BUFFER_SIZE) {
+            if (!writer->failed && !writeAll(writer->fd, data, size))
+                writer->failed = true;
+            writer->written += size;
+            return;
+        }
+    }
+
+    memcpy(writer->buffer + writer->used, data, size);
+    writer->used += size;
+}
+
+template <size_t N>
+inline void writeText(writer_t *writer, const char (&text)[N]) { // Length of a literal is known at compile time
+    writeBytes(writer, text, N - 1);
+}
+
+inline char *formatDigits(char *end, uint64_t value) { // Writes backwards from end, returns the first digit
+    do {
+        *--end = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    return end;
+}
+
+inline void writeInt(writer_t *writer, int value) {
+    char digits[12];
+    char *end = digits + sizeof(digits);
+
+    char *start = formatDigits(end, value < 0 ? 0u - (uint32_t) value : (uint32_t) value);
+    if (value < 0)
+        *--start = '-';
+
+    writeBytes(writer, start, end - start);
+}
+
+inline void writeUnsigned(writer_t *writer, uint64_t value) { // Offsets and sizes, which may not fit an int
+    char digits[20];
+    char *end = digits + sizeof(digits);
+    char *start = formatDigits(end, value);
+
+    writeBytes(writer, start, end - start);
+}
+
+inline bool isJsonSafe(unsigned char c) {
+    return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+void writeJsonEscaped(writer_t *writer, const char *data, size_t size) { // Contents of a JSON string, without the quotes
+    static const char hex[] = "0123456789abcdef";
+
+    // Bytes outside ASCII become \u00XX code points, so arbitrary names still give valid UTF-8
+    size_t safe = 0;
+    while (true) {
+        size_t start = safe;
+        while (safe < size && isJsonSafe(data[safe]))
+            safe++;
+        writeBytes(writer, data + start, safe - start);
+
+        if (safe == size)
+            return;
+
+        auto c = (unsigned char) data[safe++];
+        if (c == '"' || c == '\\') {
+            char escape[2] = {'\\', (char) c};
+            writeBytes(writer, escape, sizeof(escape));
+        } else {
+            char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+            writeBytes(writer, escape, sizeof(escape));
+        }
+    }
+}
+
+#endif